@@ -188,6 +188,20 @@ typedef signed int   SINT64 __attribute__((__mode__(__DI__)));
 
 typedef float FLOAT32;
 
+/* A word the target may use to remember how it classifies TYPE, if TYPE
+   is a canonical type (see ffi_type_struct_get); NULL for any other type,
+   since only canonical types are known never to change.  The word starts
+   out zero and must be read and written atomically.  */
+UINT64 *ffi_type_abi_cache (ffi_type *type) FFI_HIDDEN;
+
+/* SIZE bytes, at most a page, for generated code that is not a closure.
+   Returns the address to write the code to and sets *CODE to the
+   address to run it from, or returns NULL if the closure allocator has
+   no such memory.  The code must be written before it is first run and
+   not changed afterwards.  */
+void *ffi_code_alloc (size_t size, void **code) FFI_HIDDEN;
+void ffi_code_free (void *ptr, size_t size) FFI_HIDDEN;
+
 #ifndef __GNUC__
 #define __builtin_expect(x, expected_value) (x)
 #endif
@@ -28,15 +28,19 @@
 #ifndef FFI_TRAMP_H
 #define FFI_TRAMP_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int ffi_tramp_is_supported(void);
 void *ffi_tramp_alloc (int flags);
+size_t ffi_tramp_alloc_n (void **tramps, size_t n);
 void ffi_tramp_set_parms (void *tramp, void *data, void *code);
 void *ffi_tramp_get_addr (void *tramp);
 void ffi_tramp_free (void *tramp);
+void ffi_tramp_free_n (void **tramps, size_t n);
 
 #ifdef __cplusplus
 }
@@ -553,6 +553,7 @@ static size_t dlmalloc_footprint(void) MAYBE_UNUSED;
 static size_t dlmalloc_max_footprint(void) MAYBE_UNUSED;
 static void** dlindependent_calloc(size_t, size_t, void**) MAYBE_UNUSED;
 static void** dlindependent_comalloc(size_t, size_t*, void**) MAYBE_UNUSED;
+static size_t dlbulk_free(void**, size_t) MAYBE_UNUSED;
 static void *dlpvalloc(size_t) MAYBE_UNUSED;
 static int dlmalloc_trim(size_t) MAYBE_UNUSED;
 static size_t dlmalloc_usable_size(void*) MAYBE_UNUSED;
@@ -572,6 +573,191 @@ static int dlmunmap(void *, size_t);
 #undef mmap
 #undef munmap
 
+/* An index of the heap's mappings by address.
+
+   Finding the segment that holds a closure means walking dlmalloc's
+   list of segments, and a heap with many segments makes every
+   ffi_closure_free and ffi_data_to_code_pointer pay for the walk.  So
+   dlmmap and dlmunmap also record, for each page they map, the offset
+   of its executable view, in a radix tree keyed by page number: a
+   lookup is three loads and needs no lock.  Interior nodes are never
+   freed, so a lookup racing with an update sees either the old or the
+   new entry.  Addresses the tree cannot cover, or a node that could not
+   be allocated, send lookups back to the segment walk.  */
+
+#if defined(__GNUC__) \
+  && (!(defined(_WIN32) || defined(__OS2__)) || defined (__CYGWIN__) || defined(__INTERIX))
+#define FFI_CLOSURE_SEGMAP 1
+
+#include <stdint.h>
+
+#if SIZE_MAX > 0xffffffffu
+# define SEGMAP_ADDR_BITS	48
+#else
+# define SEGMAP_ADDR_BITS	32
+#endif
+/* The smallest page size we expect; larger pages are just several
+   entries.  */
+#define SEGMAP_PAGE_BITS	12
+#define SEGMAP_LEAF_BITS	12
+#define SEGMAP_MID_BITS \
+  ((SEGMAP_ADDR_BITS - SEGMAP_PAGE_BITS - SEGMAP_LEAF_BITS + 1) / 2)
+#define SEGMAP_TOP_BITS \
+  (SEGMAP_ADDR_BITS - SEGMAP_PAGE_BITS - SEGMAP_LEAF_BITS - SEGMAP_MID_BITS)
+
+/* An entry is the executable offset plus one, or zero for a page that
+   is not part of the heap.  Offsets are multiples of the page size, so
+   the low bit is free.  */
+struct segmap_leaf
+{
+  ptrdiff_t entry[1 << SEGMAP_LEAF_BITS];
+};
+
+struct segmap_mid
+{
+  struct segmap_leaf *leaf[1 << SEGMAP_MID_BITS];
+};
+
+struct segmap
+{
+  struct segmap_mid *top[1 << SEGMAP_TOP_BITS];
+  /* Nonzero once a mapping could not be recorded.  */
+  int incomplete;
+};
+
+static struct segmap segmap_data;
+#if FFI_CLOSURE_FREE_CODE
+static struct segmap segmap_code;
+#endif
+
+static void *
+segmap_node (void **slot, size_t size)
+{
+  void *node = __atomic_load_n (slot, __ATOMIC_ACQUIRE);
+
+  if (node == NULL)
+    {
+      node = mmap (NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (node == MAP_FAILED)
+	return NULL;
+      __atomic_store_n (slot, node, __ATOMIC_RELEASE);
+    }
+  return node;
+}
+
+/* Set the entries for LENGTH bytes from START to VALUE.  Called with
+   the dlmalloc lock held, so updates never race each other.  */
+static void
+segmap_set (struct segmap *map, char *start, size_t length, ptrdiff_t value)
+{
+  size_t page = (size_t) start >> SEGMAP_PAGE_BITS;
+  size_t end = ((size_t) start + length - 1) >> SEGMAP_PAGE_BITS;
+
+  if (end >> (SEGMAP_ADDR_BITS - SEGMAP_PAGE_BITS) != 0)
+    {
+      __atomic_store_n (&map->incomplete, 1, __ATOMIC_RELAXED);
+      return;
+    }
+
+  for (; page <= end; page++)
+    {
+      size_t t = page >> (SEGMAP_MID_BITS + SEGMAP_LEAF_BITS);
+      size_t m = (page >> SEGMAP_LEAF_BITS) & ((1 << SEGMAP_MID_BITS) - 1);
+      struct segmap_mid *mid;
+      struct segmap_leaf *leaf;
+
+      if (value != 0)
+	{
+	  mid = segmap_node ((void **) &map->top[t], sizeof (*mid));
+	  leaf = mid == NULL ? NULL
+	    : segmap_node ((void **) &mid->leaf[m], sizeof (*leaf));
+	  if (leaf == NULL)
+	    {
+	      __atomic_store_n (&map->incomplete, 1, __ATOMIC_RELAXED);
+	      return;
+	    }
+	}
+      else if ((mid = map->top[t]) == NULL || (leaf = mid->leaf[m]) == NULL)
+	continue;
+
+      __atomic_store_n (&leaf->entry[page & ((1 << SEGMAP_LEAF_BITS) - 1)],
+			value, __ATOMIC_RELAXED);
+    }
+}
+
+/* Look ADDR up in MAP.  Returns 1 and sets *OFFSET if it is in the
+   heap, 0 if it is not, and -1 if MAP cannot tell.  */
+static int
+segmap_find (struct segmap *map, void *addr, ptrdiff_t *offset)
+{
+  size_t page = (size_t) addr >> SEGMAP_PAGE_BITS;
+  struct segmap_mid *mid;
+  struct segmap_leaf *leaf;
+  ptrdiff_t entry = 0;
+
+  if (page >> (SEGMAP_ADDR_BITS - SEGMAP_PAGE_BITS) == 0
+      && (mid = __atomic_load_n (&map->top[page >> (SEGMAP_MID_BITS
+						    + SEGMAP_LEAF_BITS)],
+				 __ATOMIC_ACQUIRE)) != NULL
+      && (leaf = __atomic_load_n (&mid->leaf[(page >> SEGMAP_LEAF_BITS)
+					     & ((1 << SEGMAP_MID_BITS) - 1)],
+				  __ATOMIC_ACQUIRE)) != NULL)
+    entry = __atomic_load_n (&leaf->entry[page & ((1 << SEGMAP_LEAF_BITS)
+						  - 1)],
+			     __ATOMIC_RELAXED);
+
+  if (entry != 0)
+    {
+      *offset = entry - 1;
+      return 1;
+    }
+  return __atomic_load_n (&map->incomplete, __ATOMIC_RELAXED) ? -1 : 0;
+}
+
+/* Record a new mapping of LENGTH bytes at START, whose executable view
+   is OFFSET bytes away.  */
+static void
+segmap_add (char *start, size_t length, ptrdiff_t offset)
+{
+  segmap_set (&segmap_data, start, length, offset + 1);
+#if FFI_CLOSURE_FREE_CODE
+  segmap_set (&segmap_code, start + offset, length, offset + 1);
+#endif
+}
+
+static void
+segmap_remove (char *start, size_t length, ptrdiff_t offset)
+{
+  segmap_set (&segmap_data, start, length, 0);
+#if FFI_CLOSURE_FREE_CODE
+  segmap_set (&segmap_code, start + offset, length, 0);
+#else
+  (void) offset;
+#endif
+}
+#endif /* FFI_CLOSURE_SEGMAP */
+
+/* Return nonzero if PTR is in the closure heap, and set *EXEC_OFFSET to
+   the distance to its executable view.  */
+static int
+closure_heap_offset (void *ptr, ptrdiff_t *exec_offset)
+{
+  msegmentptr seg;
+
+#ifdef FFI_CLOSURE_SEGMAP
+  int found = segmap_find (&segmap_data, ptr, exec_offset);
+
+  if (found >= 0)
+    return found;
+#endif
+  seg = segment_holding (gm, ptr);
+  if (seg == NULL)
+    return 0;
+  *exec_offset = seg->exec_offset;
+  return 1;
+}
+
 #if !(defined(_WIN32) || defined(__OS2__)) || defined (__CYGWIN__) || defined(__INTERIX)
 
 /* A mutex used to synchronize access to *exec* variables in this file.  */
@@ -815,43 +1001,45 @@ allocate_space (int fd, off_t len)
   return 0;
 }
 
-/* Map in a chunk of memory from the temporary exec file into separate
-   locations in the virtual memory address space, one writable and one
-   executable.  Returns the address of the writable portion, after
-   storing an offset to the corresponding executable portion at the
-   last word of the requested chunk.  */
+/* Map in a chunk of memory from the temporary exec file *FDP, of which
+   *SIZEP bytes are already in use, into separate locations in the
+   virtual memory address space, one writable and one executable.
+   Opens the file if *FDP is -1.  Returns the address of the writable
+   portion and sets *EXEC to the executable one.  */
 static void *
-dlmmap_locked (void *start, size_t length, int prot, int flags, off_t offset)
+exec_file_map (int *fdp, size_t *sizep, void *start, size_t length,
+	       int prot, int flags, void **exec)
 {
   void *ptr;
+  off_t offset;
 
-  if (execfd == -1)
+  if (*fdp == -1)
     {
       open_temp_exec_file_opts_idx = 0;
     retry_open:
-      execfd = open_temp_exec_file ();
-      if (execfd == -1)
+      *fdp = open_temp_exec_file ();
+      if (*fdp == -1)
 	return MFAIL;
     }
 
-  offset = execsize;
+  offset = *sizep;
 
-  if (allocate_space (execfd, length))
+  if (allocate_space (*fdp, length))
     return MFAIL;
 
   flags &= ~(MAP_PRIVATE | MAP_ANONYMOUS);
   flags |= MAP_SHARED;
 
   ptr = mmap (NULL, length, (prot & ~PROT_WRITE) | PROT_EXEC,
-	      flags, execfd, offset);
+	      flags, *fdp, offset);
   if (ptr == MFAIL)
     {
       if (!offset)
 	{
-	  close (execfd);
+	  close (*fdp);
 	  goto retry_open;
 	}
-      if (ftruncate (execfd, offset) != 0)
+      if (ftruncate (*fdp, offset) != 0)
       {
         /* Fixme : Error logs can be added here. Returning an error for
          * ftruncte() will not add any advantage as it is being
@@ -864,12 +1052,12 @@ dlmmap_locked (void *start, size_t length, int prot, int flags, off_t offset)
 	   && open_temp_exec_file_opts[open_temp_exec_file_opts_idx].repeat)
     open_temp_exec_file_opts_next ();
 
-  start = mmap (start, length, prot, flags, execfd, offset);
+  start = mmap (start, length, prot, flags, *fdp, offset);
 
   if (start == MFAIL)
     {
       munmap (ptr, length);
-      if (ftruncate (execfd, offset) != 0)
+      if (ftruncate (*fdp, offset) != 0)
       {
         /* Fixme : Error logs can be added here. Returning an error for
          * ftruncte() will not add any advantage as it is being
@@ -878,18 +1066,34 @@ dlmmap_locked (void *start, size_t length, int prot, int flags, off_t offset)
       return start;
     }
 
-  mmap_exec_offset ((char *)start, length) = (char*)ptr - (char*)start;
+  *sizep += length;
+  *exec = ptr;
+
+  return start;
+}
 
-  execsize += length;
+/* Map in a chunk of memory from the temporary exec file, as
+   exec_file_map does.  Returns the address of the writable portion,
+   after storing an offset to the corresponding executable portion at
+   the last word of the requested chunk.  */
+static void *
+dlmmap_locked (void *start, size_t length, int prot, int flags,
+	       off_t offset MAYBE_UNUSED)
+{
+  void *ptr;
 
+  start = exec_file_map (&execfd, &execsize, start, length, prot, flags,
+			 &ptr);
+  if (start != MFAIL)
+    mmap_exec_offset ((char *)start, length) = (char*)ptr - (char*)start;
   return start;
 }
 
 /* Map in a writable and executable chunk of memory if possible.
    Failing that, fall back to dlmmap_locked.  */
 static void *
-dlmmap (void *start, size_t length, int prot,
-	int flags, int fd, off_t offset)
+dlmmap_exec (void *start, size_t length, int prot,
+	     int flags, int fd, off_t offset)
 {
   void *ptr;
 
@@ -951,17 +1155,163 @@ dlmunmap (void *start, size_t length)
      could locate pages in the file by writing to the pages being
      deallocated and checking that the file contents change.
      Yuck.  */
-  msegmentptr seg = segment_holding (gm, start);
-  void *code;
+  ptrdiff_t exec_offset;
+  int ret;
 
-  if (seg && (code = add_segment_exec_offset (start, seg)) != start)
+  if (closure_heap_offset (start, &exec_offset) && exec_offset != 0)
     {
-      int ret = munmap (code, length);
+      ret = munmap ((char *) start + exec_offset, length);
       if (ret)
 	return ret;
     }
+  else
+    exec_offset = 0;
+
+  ret = munmap (start, length);
+#ifdef FFI_CLOSURE_SEGMAP
+  if (ret == 0)
+    segmap_remove (start, length, exec_offset);
+#endif
+  return ret;
+}
+
+/* Map in heap memory and record it in the index.  */
+static void *
+dlmmap (void *start, size_t length, int prot,
+	int flags, int fd, off_t offset)
+{
+  void *ptr = dlmmap_exec (start, length, prot, flags, fd, offset);
+
+#ifdef FFI_CLOSURE_SEGMAP
+  if (ptr != MFAIL)
+    segmap_add (ptr, length, mmap_exec_offset ((char *) ptr, length));
+#endif
+  return ptr;
+}
+
+/* Executable memory for generated code that is not a closure, such as
+   the call stubs of FFI_CALL_PLAN_JIT.  Small blocks are packed into
+   pages mapped from a temporary exec file of their own, as the closure
+   heap is when it cannot map memory writable and executable: a writable
+   view to fill them in and an executable view to run them, so no page
+   is ever both and none changes protection.  Each page is cut into 64
+   granules, tracked by a bitmap kept outside the page.
+
+   The file is shared with a forked child, so a process only ever
+   writes to pages it mapped itself, and a child that needs a page
+   opens a file of its own.  */
+
+#define FFI_CODE_ALLOC 1
+
+struct code_page
+{
+  struct code_page *next;
+  char *data;
+  ptrdiff_t exec_offset;
+  UINT64 used;
+  pid_t owner;
+};
+
+/* N granules in a row, as bits.  */
+#define CODE_PAGE_RUN(n) ((n) == 64 ? ~(UINT64) 0 : ((UINT64) 1 << (n)) - 1)
+
+static pthread_mutex_t code_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct code_page *code_pages;
+static int codefd = -1;
+static pid_t codefd_owner;
+static size_t codesize;
+
+/* Return the first of N clear bits in a row in USED, or -1.  */
+static int
+code_page_fit (UINT64 used, unsigned n)
+{
+  UINT64 run = CODE_PAGE_RUN (n);
+  unsigned i;
+
+  for (i = 0; i + n <= 64; i++)
+    if ((used & (run << i)) == 0)
+      return (int) i;
+  return -1;
+}
+
+void *
+ffi_code_alloc (size_t size, void **code)
+{
+  size_t page = malloc_getpagesize, granule = page / 64;
+  unsigned n = (unsigned) ((size + granule - 1) / granule);
+  struct code_page *cp;
+  pid_t self = getpid ();
+  void *exec;
+  char *data;
+  int i = -1;
+
+  if (size == 0 || size > page)
+    return NULL;
+
+  pthread_mutex_lock (&code_lock);
+  for (cp = code_pages; cp != NULL; cp = cp->next)
+    if (cp->owner == self && (i = code_page_fit (cp->used, n)) >= 0)
+      break;
+
+  if (cp == NULL)
+    {
+      cp = malloc (sizeof (*cp));
+      if (cp == NULL)
+	goto fail;
+      pthread_mutex_lock (&open_temp_exec_file_mutex);
+      if (codefd != -1 && codefd_owner != self)
+	{
+	  close (codefd);
+	  codefd = -1;
+	  codesize = 0;
+	}
+      codefd_owner = self;
+      data = exec_file_map (&codefd, &codesize, NULL, page,
+			    PROT_READ | PROT_WRITE, MAP_PRIVATE, &exec);
+      pthread_mutex_unlock (&open_temp_exec_file_mutex);
+      if (data == MFAIL)
+	{
+	  free (cp);
+	  goto fail;
+	}
+      cp->data = data;
+      cp->exec_offset = (char *) exec - data;
+      cp->used = 0;
+      cp->owner = self;
+      cp->next = code_pages;
+      code_pages = cp;
+      i = 0;
+    }
+
+  cp->used |= CODE_PAGE_RUN (n) << i;
+  pthread_mutex_unlock (&code_lock);
+
+  data = cp->data + (size_t) i * granule;
+  *code = data + cp->exec_offset;
+  return data;
+
+ fail:
+  pthread_mutex_unlock (&code_lock);
+  return NULL;
+}
 
-  return munmap (start, length);
+void
+ffi_code_free (void *ptr, size_t size)
+{
+  size_t page = malloc_getpagesize, granule = page / 64;
+  unsigned n = (unsigned) ((size + granule - 1) / granule);
+  struct code_page *cp;
+  size_t i;
+
+  pthread_mutex_lock (&code_lock);
+  for (cp = code_pages; cp != NULL; cp = cp->next)
+    if ((char *) ptr >= cp->data && (char *) ptr < cp->data + page)
+      {
+	i = (size_t) ((char *) ptr - cp->data) / granule;
+	cp->used &= ~(CODE_PAGE_RUN (n) << i);
+	break;
+      }
+  pthread_mutex_unlock (&code_lock);
 }
 
 #if FFI_CLOSURE_FREE_CODE
@@ -978,10 +1328,749 @@ segment_holding_code (mstate m, char* addr)
       return 0;
   }
 }
+
+/* Return nonzero if CODE is the executable view of memory in the
+   closure heap, and set *EXEC_OFFSET to the distance from its writable
+   view.  */
+static int
+closure_heap_code_offset (void *code, ptrdiff_t *exec_offset)
+{
+  msegmentptr seg;
+
+#ifdef FFI_CLOSURE_SEGMAP
+  int found = segmap_find (&segmap_code, code, exec_offset);
+
+  if (found >= 0)
+    return found;
+#endif
+  seg = segment_holding_code (gm, code);
+  if (seg == NULL)
+    return 0;
+  *exec_offset = seg->exec_offset;
+  return 1;
+}
 #endif
 
 #endif /* !(defined(_WIN32) || defined(__OS2__)) || defined (__CYGWIN__) || defined(__INTERIX) */
 
+/* Statistics counters, see ffi_closure_heap_stats.  They are read by
+   other threads without a lock, so they are updated atomically.  */
+#if defined(__GNUC__)
+# define CLOSURE_STAT_LOAD(p)		__atomic_load_n (p, __ATOMIC_RELAXED)
+# define CLOSURE_STAT_STORE(p, v)	__atomic_store_n (p, v, __ATOMIC_RELAXED)
+# define CLOSURE_STAT_ADD(p, v)	\
+  (void) __atomic_fetch_add (p, v, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+# define CLOSURE_STAT_LOAD(p)		(*(volatile size_t *) (p))
+# define CLOSURE_STAT_STORE(p, v)	(*(volatile int *) (p) = (v))
+# define CLOSURE_STAT_ADD(p, v)	\
+  (void) InterlockedExchangeAddSizeT (p, v)
+#else
+# define CLOSURE_STAT_LOAD(p)		(*(p))
+# define CLOSURE_STAT_STORE(p, v)	(*(p) = (v))
+# define CLOSURE_STAT_ADD(p, v)	(void) (*(p) += (v))
+#endif
+
+/* Closures taken out of the heap and not yet given back, whether they
+   are held by callers or sit in a per-thread cache.  */
+static size_t closure_heap_out;
+
+/* Closures are allocated in a few fixed size classes: Go closures where
+   they exist, ffi_closure itself, and CLOSURE_SMALL_SIZE, room for the
+   closure types that extend ffi_closure by a word or two, such as raw
+   and direct closures.  Closures of these sizes are cached per thread
+   and, with static trampolines, come from slabs in the closure arena.
+   Anything larger comes straight from dlmalloc.  */
+#define CLOSURE_SMALL_SIZE	(sizeof (ffi_closure) + 2 * sizeof (void *))
+
+static const size_t closure_class_size[] = {
+#ifdef FFI_GO_CLOSURES
+  sizeof (ffi_go_closure),
+#endif
+  sizeof (ffi_closure),
+  CLOSURE_SMALL_SIZE
+};
+
+#define CLOSURE_CLASSES \
+  ((int) (sizeof (closure_class_size) / sizeof (closure_class_size[0])))
+
+/* Return the smallest class SIZE bytes fit in, or -1.  */
+static int
+closure_class (size_t size)
+{
+  int c;
+
+  for (c = 0; c < CLOSURE_CLASSES; c++)
+    if (size <= closure_class_size[c])
+      return c;
+  return -1;
+}
+
+#ifndef FFI_CLOSURE_ARENA
+# if defined FFI_EXEC_STATIC_TRAMP \
+  && (!(defined(_WIN32) || defined(__OS2__)) || defined (__CYGWIN__) || defined(__INTERIX))
+#  define FFI_CLOSURE_ARENA 1
+# else
+#  define FFI_CLOSURE_ARENA 0
+# endif
+#endif
+
+#if FFI_CLOSURE_ARENA
+/* The closure arena.
+
+   With static trampolines the code a closure runs lives in the
+   trampoline tables, and the closure itself is plain data.  There is no
+   point carving it out of the executable heap, with a dlmalloc chunk
+   header in front of it, so closures of the size classes above come
+   from here instead: one address range reserved up front and cut into
+   slabs of CLOSURE_SLAB_SIZE bytes as it fills.  A slab holds slots of a
+   single class.  Slots of up to a cache line are a power of two in size
+   and larger ones a whole number of lines, so no closure straddles a
+   line boundary it does not have to.
+
+   Slabs are aligned to their size, so the slab a slot belongs to, and
+   with it the slot's class, is found by masking its address.
+   Allocation and release are a pop and a push on the slab's free list,
+   and telling an arena closure from a dlmalloc one is a range check.
+   Once the range is used up, or if it cannot be reserved, closures come
+   from dlmalloc as before.  */
+
+#define CLOSURE_LINE		64
+#define CLOSURE_SLAB_SIZE	((size_t) 64 * 1024)
+#define CLOSURE_SLOT(size) \
+  ((size) <= 16 ? 16 : (size) <= 32 ? 32 \
+   : ((size) + CLOSURE_LINE - 1) & ~(size_t) (CLOSURE_LINE - 1))
+/* Reserve this much address space: room for millions of closures on
+   64-bit hosts, fewer where address space is scarce.  */
+#define CLOSURE_ARENA_RESERVE \
+  (sizeof (void *) > 4 ? (size_t) 1 << 30 : (size_t) 32 << 20)
+
+#ifndef MAP_NORESERVE
+# define MAP_NORESERVE 0
+#endif
+
+struct closure_arena_slot
+{
+  struct closure_arena_slot *next;
+};
+
+/* The header at the start of each slab.  */
+struct closure_slab
+{
+  /* The next slab with free slots of the same class, or the next spare
+     slab.  */
+  struct closure_slab *next;
+  struct closure_arena_slot *free;
+  /* Slots below BUMP have been handed out at least once.  */
+  unsigned int bump;
+  unsigned int used;
+  unsigned int nslots;
+  unsigned int slot;
+  int cls;
+  /* Nonzero while on its class's list of slabs with free slots.  */
+  int listed;
+};
+
+/* The first slot starts on the cache line after the header.  */
+#define CLOSURE_SLAB_HEADER \
+  ((sizeof (struct closure_slab) + CLOSURE_LINE - 1) \
+   & ~(size_t) (CLOSURE_LINE - 1))
+
+static struct
+{
+  pthread_mutex_t lock;
+  /* The reserved range.  BASE is published last, so a thread that sees
+     it also sees LIMIT.  */
+  char *base, *limit;
+  /* Slabs below TOP have been committed.  */
+  char *top;
+  /* Slabs with free slots, by class.  */
+  struct closure_slab *partial[CLOSURE_CLASSES];
+  /* Empty slabs whose pages ffi_closure_heap_trim gave back.  */
+  struct closure_slab *spare;
+  size_t released, max_footprint;
+  int failed;
+} closure_arena = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Return nonzero if PTR is a slot in the closure arena.  */
+static int
+closure_arena_holds (void *ptr)
+{
+  char *base = __atomic_load_n (&closure_arena.base, __ATOMIC_ACQUIRE);
+
+  return base != NULL && (char *) ptr >= base
+    && (char *) ptr < closure_arena.limit;
+}
+
+static struct closure_slab *
+closure_slab_of (void *ptr)
+{
+  return (struct closure_slab *) ((size_t) ptr & ~(CLOSURE_SLAB_SIZE - 1));
+}
+
+/* The bytes of a slab madvise can give back: all but its first page.  */
+static size_t
+closure_slab_releasable (void)
+{
+#ifdef MADV_DONTNEED
+  size_t page = malloc_getpagesize;
+
+  if (page < CLOSURE_SLAB_SIZE)
+    return CLOSURE_SLAB_SIZE - page;
+#endif
+  return 0;
+}
+
+/* Reserve the arena's address range, aligned to the slab size.  Called
+   with the lock held.  */
+static int
+closure_arena_reserve (void)
+{
+  char *addr, *base;
+  size_t size = CLOSURE_ARENA_RESERVE + CLOSURE_SLAB_SIZE;
+
+  if (closure_arena.base != NULL)
+    return 1;
+  if (closure_arena.failed)
+    return 0;
+
+  addr = mmap (NULL, size, PROT_NONE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED)
+    {
+      closure_arena.failed = 1;
+      return 0;
+    }
+
+  base = (char *) (((size_t) addr + CLOSURE_SLAB_SIZE - 1)
+		   & ~(CLOSURE_SLAB_SIZE - 1));
+  if (base != addr)
+    munmap (addr, base - addr);
+  munmap (base + CLOSURE_ARENA_RESERVE,
+	  addr + size - (base + CLOSURE_ARENA_RESERVE));
+
+  closure_arena.limit = base + CLOSURE_ARENA_RESERVE;
+  closure_arena.top = base;
+  __atomic_store_n (&closure_arena.base, base, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* Set up a slab for class CLS and put it on the class's list, reusing a
+   spare slab if there is one.  Called with the lock held.  */
+static struct closure_slab *
+closure_slab_new (int cls)
+{
+  struct closure_slab *slab;
+  size_t footprint;
+
+  if ((slab = closure_arena.spare) != NULL)
+    {
+      closure_arena.spare = slab->next;
+      closure_arena.released -= closure_slab_releasable ();
+    }
+  else
+    {
+      if ((size_t) (closure_arena.limit - closure_arena.top)
+	  < CLOSURE_SLAB_SIZE
+	  || mprotect (closure_arena.top, CLOSURE_SLAB_SIZE,
+		       PROT_READ | PROT_WRITE) != 0)
+	return NULL;
+      slab = (struct closure_slab *) closure_arena.top;
+      closure_arena.top += CLOSURE_SLAB_SIZE;
+    }
+
+  slab->free = NULL;
+  slab->bump = slab->used = 0;
+  slab->slot = CLOSURE_SLOT (closure_class_size[cls]);
+  slab->nslots = (CLOSURE_SLAB_SIZE - CLOSURE_SLAB_HEADER) / slab->slot;
+  slab->cls = cls;
+  slab->listed = 1;
+  slab->next = closure_arena.partial[cls];
+  closure_arena.partial[cls] = slab;
+
+  footprint = closure_arena.top - closure_arena.base - closure_arena.released;
+  if (footprint > closure_arena.max_footprint)
+    closure_arena.max_footprint = footprint;
+  return slab;
+}
+
+/* Take up to N slots of class CLS from the arena.  Returns how many
+   were stored in SLOTS.  */
+static size_t
+closure_arena_alloc_n (int cls, void **slots, size_t n)
+{
+  struct closure_slab *slab;
+  struct closure_arena_slot *it;
+  size_t i;
+
+  pthread_mutex_lock (&closure_arena.lock);
+  if (!closure_arena_reserve ())
+    {
+      pthread_mutex_unlock (&closure_arena.lock);
+      return 0;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      slab = closure_arena.partial[cls];
+      if (slab == NULL && (slab = closure_slab_new (cls)) == NULL)
+	break;
+
+      if ((it = slab->free) != NULL)
+	slab->free = it->next;
+      else
+	it = (struct closure_arena_slot *)
+	  ((char *) slab + CLOSURE_SLAB_HEADER + slab->bump++ * slab->slot);
+      slots[i] = it;
+
+      /* A full slab leaves the list until a slot comes back.  */
+      if (++slab->used == slab->nslots)
+	{
+	  closure_arena.partial[cls] = slab->next;
+	  slab->listed = 0;
+	}
+    }
+
+  pthread_mutex_unlock (&closure_arena.lock);
+  return i;
+}
+
+/* Put N slots back into their slabs.  */
+static void
+closure_arena_free_n (void **slots, size_t n)
+{
+  struct closure_slab *slab;
+  struct closure_arena_slot *it;
+  size_t i;
+
+  if (n == 0)
+    return;
+
+  pthread_mutex_lock (&closure_arena.lock);
+  for (i = 0; i < n; i++)
+    {
+      it = slots[i];
+      slab = closure_slab_of (it);
+      it->next = slab->free;
+      slab->free = it;
+      slab->used--;
+      if (!slab->listed)
+	{
+	  slab->next = closure_arena.partial[slab->cls];
+	  closure_arena.partial[slab->cls] = slab;
+	  slab->listed = 1;
+	}
+    }
+  pthread_mutex_unlock (&closure_arena.lock);
+}
+
+/* Give the pages of every empty slab back to the system and keep the
+   slabs as spares.  Returns nonzero if any were given back.  */
+static int
+closure_arena_trim (void)
+{
+  struct closure_slab *slab, **pp;
+  size_t releasable = closure_slab_releasable ();
+  int c, trimmed = 0;
+
+  pthread_mutex_lock (&closure_arena.lock);
+  for (c = 0; c < CLOSURE_CLASSES; c++)
+    for (pp = &closure_arena.partial[c]; (slab = *pp) != NULL; )
+      {
+	if (slab->used != 0)
+	  {
+	    pp = &slab->next;
+	    continue;
+	  }
+	*pp = slab->next;
+	slab->listed = 0;
+#ifdef MADV_DONTNEED
+	if (releasable != 0)
+	  madvise ((char *) slab + CLOSURE_SLAB_SIZE - releasable,
+		   releasable, MADV_DONTNEED);
+#endif
+	slab->next = closure_arena.spare;
+	closure_arena.spare = slab;
+	closure_arena.released += releasable;
+	trimmed |= releasable != 0;
+      }
+  pthread_mutex_unlock (&closure_arena.lock);
+  return trimmed;
+}
+
+/* The bytes the arena holds now, and the most it ever held.  */
+static void
+closure_arena_footprint (size_t *footprint, size_t *max_footprint)
+{
+  pthread_mutex_lock (&closure_arena.lock);
+  *footprint = closure_arena.top - closure_arena.base - closure_arena.released;
+  *max_footprint = closure_arena.max_footprint;
+  pthread_mutex_unlock (&closure_arena.lock);
+}
+#endif /* FFI_CLOSURE_ARENA */
+
+/* Allocate N closures of SIZE bytes into CHUNKS, all or none: from the
+   closure arena when they are plain data and of a known class,
+   otherwise as one dlmalloc chunk.  Returns nonzero on success.  */
+static int
+closure_chunks_alloc (size_t size, size_t n, void **chunks)
+{
+#if FFI_CLOSURE_ARENA
+  int c = closure_class (size);
+
+  if (c >= 0 && ffi_tramp_is_supported ())
+    {
+      size_t got = closure_arena_alloc_n (c, chunks, n);
+
+      if (got == n)
+	return 1;
+      closure_arena_free_n (chunks, got);
+    }
+#endif
+  return dlindependent_calloc (n, size, chunks) != NULL;
+}
+
+/* Release N closures obtained from closure_chunks_alloc or
+   closure_chunk_alloc.  The order of CHUNKS is not preserved.  */
+static void
+closure_chunks_free (void **chunks, size_t n)
+{
+#if FFI_CLOSURE_ARENA
+  size_t i, narena = 0;
+
+  /* Move the arena slots to the front.  */
+  for (i = 0; i < n; i++)
+    if (closure_arena_holds (chunks[i]))
+      {
+	void *tmp = chunks[narena];
+	chunks[narena++] = chunks[i];
+	chunks[i] = tmp;
+      }
+  closure_arena_free_n (chunks, narena);
+  chunks += narena;
+  n -= narena;
+#endif
+  dlbulk_free (chunks, n);
+}
+
+static void *
+closure_chunk_alloc (size_t size)
+{
+#if FFI_CLOSURE_ARENA
+  void *ptr;
+  int c = closure_class (size);
+
+  if (c >= 0 && ffi_tramp_is_supported ()
+      && closure_arena_alloc_n (c, &ptr, 1) == 1)
+    return ptr;
+#endif
+  return dlmalloc (size);
+}
+
+static void
+closure_chunk_free (void *ptr)
+{
+#if FFI_CLOSURE_ARENA
+  if (closure_arena_holds (ptr))
+    {
+      closure_arena_free_n (&ptr, 1);
+      return;
+    }
+#endif
+  dlfree (ptr);
+}
+
+#ifndef FFI_CLOSURE_CACHE
+# if !(defined(_WIN32) || defined(__OS2__)) || defined (__CYGWIN__) || defined(__INTERIX)
+#  define FFI_CLOSURE_CACHE 1
+# else
+#  define FFI_CLOSURE_CACHE 0
+# endif
+#endif
+
+#if FFI_CLOSURE_CACHE
+/* Per-thread closure caches.
+
+   Every closure allocation would otherwise take the allocator lock and,
+   with static trampolines, the trampoline lock too.  Instead each thread
+   keeps a magazine of free closures per size class with their trampoline
+   and code address already attached.  An empty magazine is refilled with
+   CLOSURE_CACHE_BATCH closures under one hold of each lock, and a full
+   one hands a batch back the same way, so most allocations and releases
+   take no shared lock at all.  The exception is releasing a closure that
+   came from dlmalloc rather than the closure arena: its size class is
+   read from the chunk header, which takes the heap lock.
+
+   Each thread's magazines have a lock of their own, the same kind the
+   heap uses.  Only ffi_closure_heap_trim, which empties every thread's
+   magazines, ever contends for it, so for the owning thread it is an
+   uncontended lock on a line no other thread touches.  */
+
+#define CLOSURE_CACHE_BATCH	32
+#define CLOSURE_CACHE_MAX	(2 * CLOSURE_CACHE_BATCH)
+
+/* A closure sitting in a magazine.  FTRAMP overlays ffi_closure's own
+   ftramp field, so a trampoline stays attached while cached.  */
+struct closure_cache_item
+{
+  void *ftramp;
+  struct closure_cache_item *next;
+  void *code;
+};
+
+struct closure_cache
+{
+  MLOCK_T lock;
+  struct closure_cache_item *head[CLOSURE_CLASSES];
+  int count[CLOSURE_CLASSES];
+  /* Links in the list of all magazines, for ffi_closure_heap_stats.  */
+  struct closure_cache *prev, *next;
+};
+
+static pthread_once_t closure_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t closure_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct closure_cache *closure_caches;
+static pthread_key_t closure_cache_key;
+static int closure_cache_ok;
+static int closure_cache_tramps;
+
+/* Give the N most recently cached closures of class C back to the
+   global pools.  Called with CC's lock held.  */
+static void
+closure_cache_drain (struct closure_cache *cc, int c, int n)
+{
+  void *chunks[CLOSURE_CACHE_MAX], *tramps[CLOSURE_CACHE_MAX];
+  struct closure_cache_item *it;
+  int i;
+
+  for (i = 0; i < n && (it = cc->head[c]) != NULL; i++)
+    {
+      cc->head[c] = it->next;
+      chunks[i] = it;
+      tramps[i] = it->ftramp;
+    }
+  CLOSURE_STAT_STORE (&cc->count[c], cc->count[c] - i);
+
+  if (closure_cache_tramps)
+    ffi_tramp_free_n (tramps, i);
+  closure_chunks_free (chunks, i);
+  CLOSURE_STAT_ADD (&closure_heap_out, -(size_t) i);
+}
+
+/* Empty every magazine of CC.  Called with CC's lock held.  */
+static void
+closure_cache_drain_all (struct closure_cache *cc)
+{
+  int c;
+
+  for (c = 0; c < CLOSURE_CLASSES; c++)
+    while (cc->count[c] > 0)
+      closure_cache_drain (cc, c, CLOSURE_CACHE_MAX);
+}
+
+static void
+closure_cache_destroy (void *arg)
+{
+  struct closure_cache *cc = arg;
+
+  ACQUIRE_LOCK (&cc->lock);
+  closure_cache_drain_all (cc);
+  RELEASE_LOCK (&cc->lock);
+
+  pthread_mutex_lock (&closure_cache_mutex);
+  if (cc->prev != NULL)
+    cc->prev->next = cc->next;
+  else
+    closure_caches = cc->next;
+  if (cc->next != NULL)
+    cc->next->prev = cc->prev;
+  pthread_mutex_unlock (&closure_cache_mutex);
+
+  (void) DESTROY_LOCK (&cc->lock);
+  free (cc);
+}
+
+static void
+closure_cache_init (void)
+{
+  closure_cache_tramps = ffi_tramp_is_supported ();
+  closure_cache_ok
+    = pthread_key_create (&closure_cache_key, closure_cache_destroy) == 0;
+}
+
+#ifdef __GNUC__
+/* If libffi is unloaded, a thread exiting later must not run
+   closure_cache_destroy from unmapped code.  Closures still cached by
+   live threads are leaked.  */
+__attribute__ ((destructor)) static void
+closure_cache_fini (void)
+{
+  if (closure_cache_ok)
+    {
+      closure_cache_ok = 0;
+      pthread_key_delete (closure_cache_key);
+    }
+}
+#endif
+
+/* Return the calling thread's magazines, creating them on first use, or
+   NULL if the thread cannot have any.  */
+static struct closure_cache *
+closure_cache_get (void)
+{
+  struct closure_cache *cc;
+
+  if (pthread_once (&closure_cache_once, closure_cache_init) != 0
+      || !closure_cache_ok)
+    return NULL;
+
+  cc = pthread_getspecific (closure_cache_key);
+  if (cc == NULL)
+    {
+      cc = calloc (1, sizeof (*cc));
+      if (cc == NULL)
+	return NULL;
+      INITIAL_LOCK (&cc->lock);
+      if (pthread_setspecific (closure_cache_key, cc) != 0)
+	{
+	  (void) DESTROY_LOCK (&cc->lock);
+	  free (cc);
+	  return NULL;
+	}
+
+      pthread_mutex_lock (&closure_cache_mutex);
+      cc->next = closure_caches;
+      if (closure_caches != NULL)
+	closure_caches->prev = cc;
+      closure_caches = cc;
+      pthread_mutex_unlock (&closure_cache_mutex);
+    }
+  return cc;
+}
+
+/* Allocate CLOSURE_CACHE_BATCH closures of class C in one go and attach
+   a trampoline to each.  Called with CC's lock held.  */
+static int
+closure_cache_refill (struct closure_cache *cc, int c)
+{
+  void *chunks[CLOSURE_CACHE_BATCH], *tramps[CLOSURE_CACHE_BATCH];
+  struct closure_cache_item *it;
+  ptrdiff_t exec_offset = 0;
+  int i, n = CLOSURE_CACHE_BATCH;
+
+  if (!closure_chunks_alloc (closure_class_size[c], n, chunks))
+    return 0;
+
+  if (closure_cache_tramps)
+    {
+      n = (int) ffi_tramp_alloc_n (tramps, n);
+      if (n < CLOSURE_CACHE_BATCH)
+	closure_chunks_free (chunks + n, CLOSURE_CACHE_BATCH - n);
+    }
+  else
+    /* The chunks are adjacent, so they share one segment.  */
+    closure_heap_offset (chunks[0], &exec_offset);
+
+  for (i = 0; i < n; i++)
+    {
+      it = chunks[i];
+      if (closure_cache_tramps)
+	{
+	  it->ftramp = tramps[i];
+	  it->code = ffi_tramp_get_addr (tramps[i]);
+	}
+      else
+	it->code = (char *) it + exec_offset;
+      it->next = cc->head[c];
+      cc->head[c] = it;
+    }
+  CLOSURE_STAT_STORE (&cc->count[c], cc->count[c] + n);
+  CLOSURE_STAT_ADD (&closure_heap_out, n);
+
+  return n > 0;
+}
+
+static void *
+closure_cache_alloc (int c, void **code)
+{
+  struct closure_cache *cc = closure_cache_get ();
+  struct closure_cache_item *it;
+
+  if (cc == NULL)
+    return NULL;
+
+  ACQUIRE_LOCK (&cc->lock);
+  if (cc->head[c] == NULL && !closure_cache_refill (cc, c))
+    {
+      RELEASE_LOCK (&cc->lock);
+      return NULL;
+    }
+  it = cc->head[c];
+  cc->head[c] = it->next;
+  CLOSURE_STAT_STORE (&cc->count[c], cc->count[c] - 1);
+  RELEASE_LOCK (&cc->lock);
+  *code = FFI_FN (it->code);
+
+  return it;
+}
+
+/* Put PTR, a writable closure address, into the calling thread's
+   magazine for its class.  Return zero if it has to be released the
+   slow way.  */
+static int
+closure_cache_free (void *ptr)
+{
+  struct closure_cache *cc;
+  struct closure_cache_item *it = ptr;
+  ptrdiff_t exec_offset;
+  int c;
+
+#if FFI_CLOSURE_ARENA
+  if (closure_arena_holds (ptr))
+    c = closure_slab_of (ptr)->cls;
+  else
+#endif
+    {
+      /* Only chunks that closure_cache_alloc could have handed out.  The
+	 chunk header is read under the heap lock: freeing the chunk below
+	 rewrites its PINUSE bit.  */
+      size_t usable;
+
+      if (PREACTION (gm))
+	return 0;
+      usable = dlmalloc_usable_size (ptr);
+      POSTACTION (gm);
+
+      for (c = CLOSURE_CLASSES - 1; c >= 0; c--)
+	if (usable >= closure_class_size[c])
+	  break;
+      if (c < 0 || usable >= closure_class_size[c] + 2 * MALLOC_ALIGNMENT)
+	return 0;
+    }
+
+  cc = closure_cache_get ();
+  if (cc == NULL)
+    return 0;
+
+  if (closure_cache_tramps)
+    it->code = ffi_tramp_get_addr (it->ftramp);
+  else if (closure_heap_offset (ptr, &exec_offset))
+    it->code = (char *) ptr + exec_offset;
+  else
+    return 0;
+
+  ACQUIRE_LOCK (&cc->lock);
+  if (cc->count[c] >= CLOSURE_CACHE_MAX)
+    closure_cache_drain (cc, c, CLOSURE_CACHE_BATCH);
+  it->next = cc->head[c];
+  cc->head[c] = it;
+  CLOSURE_STAT_STORE (&cc->count[c], cc->count[c] + 1);
+  RELEASE_LOCK (&cc->lock);
+
+  return 1;
+}
+#endif /* FFI_CLOSURE_CACHE */
+
 /* Allocate a chunk of memory with the given size.  Returns a pointer
    to the writable address, and sets *CODE to the executable
    corresponding virtual address.  */
@@ -993,41 +2082,59 @@ ffi_closure_alloc (size_t size, void **code)
   if (!code)
     return NULL;
 
-  ptr = dlmalloc (size);
+#if FFI_CLOSURE_CACHE
+  {
+    int c = closure_class (size);
 
-  if (ptr)
-    {
-      msegmentptr seg = segment_holding (gm, ptr);
+    if (c >= 0 && (ptr = closure_cache_alloc (c, code)) != NULL)
+      return ptr;
+  }
+#endif
 
-      *code = FFI_FN (add_segment_exec_offset (ptr, seg));
-      if (!ffi_tramp_is_supported ())
-        return ptr;
+  ptr = closure_chunk_alloc (size);
+  if (ptr == NULL)
+    return NULL;
+
+  if (!ffi_tramp_is_supported ())
+    {
+      ptrdiff_t exec_offset = 0;
 
+      closure_heap_offset (ptr, &exec_offset);
+      *code = FFI_FN ((char *) ptr + exec_offset);
+    }
+  else
+    {
       ftramp = ffi_tramp_alloc (0);
       if (ftramp == NULL)
       {
-        dlfree (ptr);
+        closure_chunk_free (ptr);
         return NULL;
       }
       *code = FFI_FN (ffi_tramp_get_addr (ftramp));
       ((ffi_closure *) ptr)->ftramp = ftramp;
     }
 
+  CLOSURE_STAT_ADD (&closure_heap_out, 1);
   return ptr;
 }
 
 void *
 ffi_data_to_code_pointer (void *data)
 {
-  msegmentptr seg = segment_holding (gm, data);
+  ptrdiff_t exec_offset;
+
+#if FFI_CLOSURE_ARENA
+  if (closure_arena_holds (data))
+    return ffi_tramp_get_addr (((ffi_closure *) data)->ftramp);
+#endif
   /* We expect closures to be allocated with ffi_closure_alloc(), in
-     which case seg will be non-NULL.  However, some users take on the
+     which case they are in the heap.  However, some users take on the
      burden of managing this memory themselves, in which case this
      we'll just return data. */
-  if (seg)
+  if (closure_heap_offset (data, &exec_offset))
     {
       if (!ffi_tramp_is_supported ())
-        return add_segment_exec_offset (data, seg);
+        return (char *) data + exec_offset;
       return ffi_tramp_get_addr (((ffi_closure *) data)->ftramp);
     }
   else
@@ -1042,22 +2149,198 @@ void
 ffi_closure_free (void *ptr)
 {
 #if FFI_CLOSURE_FREE_CODE
-  msegmentptr seg = segment_holding_code (gm, ptr);
+  ptrdiff_t exec_offset;
 
-  if (seg)
-    ptr = sub_segment_exec_offset (ptr, seg);
+  if (closure_heap_code_offset (ptr, &exec_offset))
+    ptr = (char *) ptr - exec_offset;
+#endif
+#if FFI_CLOSURE_CACHE
+  if (closure_cache_free (ptr))
+    return;
 #endif
   if (ffi_tramp_is_supported ())
     ffi_tramp_free (((ffi_closure *) ptr)->ftramp);
 
-  dlfree (ptr);
+  closure_chunk_free (ptr);
+  CLOSURE_STAT_ADD (&closure_heap_out, -(size_t) 1);
+}
+
+#define FFI_CLOSURE_ALLOC_N 1
+
+/* Allocate N chunks of SIZE bytes at once: all of them are carved out
+   of one dlmalloc chunk, or taken from the closure arena under one hold
+   of its lock, and with static trampolines the trampolines are reserved
+   under one hold of the trampoline lock.  Returns nonzero
+   on success; on failure nothing is allocated.  */
+int
+ffi_closure_alloc_n (size_t size, size_t n, void **closures, void **code)
+{
+  ptrdiff_t exec_offset = 0;
+  size_t i;
+
+  if (!closures || !code)
+    return 0;
+  if (n == 0)
+    return 1;
+
+  if (!closure_chunks_alloc (size, n, closures))
+    return 0;
+
+  if (!ffi_tramp_is_supported ())
+    {
+      /* The chunks are adjacent, so they share one segment.  */
+      closure_heap_offset (closures[0], &exec_offset);
+      for (i = 0; i < n; i++)
+	code[i] = FFI_FN ((char *) closures[i] + exec_offset);
+      CLOSURE_STAT_ADD (&closure_heap_out, n);
+      return 1;
+    }
+
+  /* Collect the trampolines in CODE, then replace each by its address.  */
+  i = ffi_tramp_alloc_n (code, n);
+  if (i < n)
+    {
+      ffi_tramp_free_n (code, i);
+      closure_chunks_free (closures, n);
+      return 0;
+    }
+  for (i = 0; i < n; i++)
+    {
+      ((ffi_closure *) closures[i])->ftramp = code[i];
+      code[i] = FFI_FN (ffi_tramp_get_addr (code[i]));
+    }
+  CLOSURE_STAT_ADD (&closure_heap_out, n);
+  return 1;
+}
+
+/* Release N closures, in batches that each take the allocator locks
+   once.  The array itself is left unchanged.  */
+void
+ffi_closure_free_n (void **closures, size_t n)
+{
+  void *chunks[64], *tramps[64];
+  int tramp = ffi_tramp_is_supported ();
+  size_t i, j;
+
+  for (i = 0; i < n; i += j)
+    {
+      for (j = 0; j < 64 && i + j < n; j++)
+	{
+	  void *ptr = closures[i + j];
+#if FFI_CLOSURE_FREE_CODE
+	  ptrdiff_t exec_offset;
+
+	  if (closure_heap_code_offset (ptr, &exec_offset))
+	    ptr = (char *) ptr - exec_offset;
+#endif
+	  chunks[j] = ptr;
+	  if (tramp)
+	    tramps[j] = ((ffi_closure *) ptr)->ftramp;
+	}
+      if (tramp)
+	ffi_tramp_free_n (tramps, j);
+      closure_chunks_free (chunks, j);
+      CLOSURE_STAT_ADD (&closure_heap_out, -j);
+    }
+}
+
+#define FFI_CLOSURE_HEAP_STATS 1
+
+/* Report on the heap closures are allocated from.  */
+int
+ffi_closure_heap_stats (struct ffi_closure_heap_stats *stats)
+{
+  msegmentptr sp;
+
+  memset (stats, 0, sizeof (*stats));
+
+  ensure_initialization ();
+  if (!PREACTION (gm))
+    {
+      for (sp = &gm->seg; sp != NULL; sp = sp->next)
+	if (sp->base != NULL)
+	  stats->segments++;
+      POSTACTION (gm);
+    }
+  stats->footprint = dlmalloc_footprint ();
+  stats->max_footprint = dlmalloc_max_footprint ();
+#if FFI_CLOSURE_ARENA
+  {
+    size_t arena, max_arena;
+
+    closure_arena_footprint (&arena, &max_arena);
+    stats->footprint += arena;
+    stats->max_footprint += max_arena;
+    stats->segments += arena != 0;
+  }
+#endif
+
+#if FFI_CLOSURE_CACHE
+  {
+    struct closure_cache *cc;
+    int c;
+
+    pthread_mutex_lock (&closure_cache_mutex);
+    for (cc = closure_caches; cc != NULL; cc = cc->next)
+      for (c = 0; c < CLOSURE_CLASSES; c++)
+	stats->cached_closures += CLOSURE_STAT_LOAD (&cc->count[c]);
+    pthread_mutex_unlock (&closure_cache_mutex);
+  }
+#endif
+  /* The counters are read at slightly different times; don't let a
+     closure moving into a cache meanwhile make the difference wrap.  */
+  stats->live_closures = CLOSURE_STAT_LOAD (&closure_heap_out);
+  if (stats->live_closures >= stats->cached_closures)
+    stats->live_closures -= stats->cached_closures;
+  else
+    stats->live_closures = 0;
+
+#if !(defined(_WIN32) || defined(__OS2__)) || defined (__CYGWIN__) || defined(__INTERIX)
+  pthread_mutex_lock (&open_temp_exec_file_mutex);
+  stats->exec_file_bytes = execfd == -1 ? 0 : execsize;
+  pthread_mutex_unlock (&open_temp_exec_file_mutex);
+#endif
+
+  return 1;
+}
+
+/* Give free memory at the top of the closure heap, whole free
+   segments and the pages of empty arena slabs back to the system,
+   leaving PAD bytes of the heap.  Every thread's closure cache is
+   emptied first.  Returns nonzero if anything was released.  */
+int
+ffi_closure_heap_trim (size_t pad)
+{
+  int trimmed;
+#if FFI_CLOSURE_CACHE
+  struct closure_cache *cc;
+
+  pthread_mutex_lock (&closure_cache_mutex);
+  for (cc = closure_caches; cc != NULL; cc = cc->next)
+    {
+      ACQUIRE_LOCK (&cc->lock);
+      closure_cache_drain_all (cc);
+      RELEASE_LOCK (&cc->lock);
+    }
+  pthread_mutex_unlock (&closure_cache_mutex);
+#endif
+  trimmed = dlmalloc_trim (pad);
+#if FFI_CLOSURE_ARENA
+  trimmed |= closure_arena_trim ();
+#endif
+  return trimmed;
 }
 
 int
 ffi_tramp_is_present (void *ptr)
 {
-  msegmentptr seg = segment_holding (gm, ptr);
-  return seg != NULL && ffi_tramp_is_supported();
+  ptrdiff_t exec_offset;
+
+#if FFI_CLOSURE_ARENA
+  if (closure_arena_holds (ptr))
+    return 1;
+#endif
+  return closure_heap_offset (ptr, &exec_offset) && ffi_tramp_is_supported();
 }
 
 # else /* ! FFI_MMAP_EXEC_WRIT */
@@ -1102,4 +2385,76 @@ ffi_tramp_is_present (__attribute__((unused)) void *ptr)
 #endif /* FFI_CLOSURES */
 
 #endif /* NetBSD with PROT_MPROTECT */
+
+#if FFI_CLOSURES && !defined FFI_CLOSURE_ALLOC_N
+
+/* Allocators without a bulk path: one closure at a time.  */
+
+int
+ffi_closure_alloc_n (size_t size, size_t n, void **closures, void **code)
+{
+  size_t i;
+
+  if (!closures || !code)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    if ((closures[i] = ffi_closure_alloc (size, &code[i])) == NULL)
+      {
+	ffi_closure_free_n (closures, i);
+	return 0;
+      }
+  return 1;
+}
+
+void
+ffi_closure_free_n (void **closures, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    ffi_closure_free (closures[i]);
+}
+
+#endif /* FFI_CLOSURES && !FFI_CLOSURE_ALLOC_N */
+
+#if FFI_CLOSURES && !defined FFI_CLOSURE_HEAP_STATS
+
+#include <string.h>
+
+/* Allocators that keep no heap of their own have nothing to report.  */
+
+int
+ffi_closure_heap_stats (struct ffi_closure_heap_stats *stats)
+{
+  memset (stats, 0, sizeof (*stats));
+  return 0;
+}
+
+int
+ffi_closure_heap_trim (size_t pad)
+{
+  (void) pad;
+  return 0;
+}
+
+#endif /* FFI_CLOSURES && !FFI_CLOSURE_HEAP_STATS */
+
+#if FFI_CLOSURES && !defined FFI_CODE_ALLOC
+
+/* Allocators without a heap of their own for generated code have none
+   to hand out; callers keep their slower path.  */
+
+void *
+ffi_code_alloc (size_t size MAYBE_UNUSED, void **code MAYBE_UNUSED)
+{
+  return NULL;
+}
+
+void
+ffi_code_free (void *ptr MAYBE_UNUSED, size_t size MAYBE_UNUSED)
+{
+}
+
+#endif /* FFI_CLOSURES && !FFI_CODE_ALLOC */
 #endif /* __EMSCRIPTEN__ */
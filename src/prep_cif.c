@@ -27,11 +27,37 @@
 #include <ffi.h>
 #include <ffi_common.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
 
 /* Round up to FFI_SIZEOF_ARG. */
 
 #define STACK_ARG_SIZE(x) FFI_ALIGN(x, FFI_SIZEOF_ARG)
 
+/* Aggregate types are laid out lazily, the first time they are seen, and
+   threads preparing cifs at once may share them.  A layout is computed in
+   locals and published by storing the size last, with release semantics,
+   so a nonzero size read with TYPE_SIZE means the alignment and the
+   layout of every member are visible too.  Threads that race to lay out
+   the same type compute and store the same values.  */
+#if defined(__GNUC__)
+#define TYPE_SIZE(t)	__atomic_load_n (&(t)->size, __ATOMIC_ACQUIRE)
+#define TYPE_PUBLISH(t, s, a) \
+  (__atomic_store_n (&(t)->alignment, (a), __ATOMIC_RELAXED), \
+   __atomic_store_n (&(t)->size, (s), __ATOMIC_RELEASE))
+#else
+#define TYPE_SIZE(t)	(*(volatile size_t *) &(t)->size)
+#define TYPE_PUBLISH(t, s, a) \
+  ((t)->alignment = (a), *(volatile size_t *) &(t)->size = (s))
+#endif
+
 /* Compute the machine-independent layout of a vector (SIMD) type.
 
    A vector is described exactly like a struct -- arg->elements is a
@@ -93,8 +119,7 @@ initialize_vector (ffi_type *arg)
   for (p2 = 1; p2 < total; p2 <<= 1)
     ;
 
-  arg->size = p2;
-  arg->alignment = p2 < 16 ? p2 : 16;
+  TYPE_PUBLISH (arg, p2, (unsigned short) (p2 < 16 ? p2 : 16));
   return FFI_OK;
 }
 
@@ -104,6 +129,8 @@ initialize_vector (ffi_type *arg)
 static ffi_status initialize_aggregate(ffi_type *arg, size_t *offsets)
 {
   ffi_type **ptr;
+  size_t size = 0;
+  unsigned short alignment = 0;
 
   if (UNLIKELY(arg == NULL || arg->elements == NULL))
     return FFI_BAD_TYPEDEF;
@@ -111,9 +138,6 @@ static ffi_status initialize_aggregate(ffi_type *arg, size_t *offsets)
   if (arg->type == FFI_TYPE_VECTOR)
     return initialize_vector (arg);
 
-  arg->size = 0;
-  arg->alignment = 0;
-
   ptr = &(arg->elements[0]);
 
   if (UNLIKELY(ptr == 0))
@@ -121,20 +145,20 @@ static ffi_status initialize_aggregate(ffi_type *arg, size_t *offsets)
 
   while ((*ptr) != NULL)
     {
-      if (UNLIKELY(((*ptr)->size == 0)
+      if (UNLIKELY((TYPE_SIZE(*ptr) == 0)
 		    && (initialize_aggregate((*ptr), NULL) != FFI_OK)))
 	return FFI_BAD_TYPEDEF;
 
       /* Perform a sanity check on the argument type */
       FFI_ASSERT_VALID_TYPE(*ptr);
 
-      arg->size = FFI_ALIGN(arg->size, (*ptr)->alignment);
+      size = FFI_ALIGN(size, (*ptr)->alignment);
       if (offsets)
-	*offsets++ = arg->size;
-      arg->size += (*ptr)->size;
+	*offsets++ = size;
+      size += (*ptr)->size;
 
-      arg->alignment = (arg->alignment > (*ptr)->alignment) ?
-	arg->alignment : (*ptr)->alignment;
+      alignment = (alignment > (*ptr)->alignment) ?
+	alignment : (*ptr)->alignment;
 
       ptr++;
     }
@@ -146,19 +170,20 @@ static ffi_status initialize_aggregate(ffi_type *arg, size_t *offsets)
      struct A { long a; char b; }; struct B { struct A x; char y; };
      should find y at an offset of 2*sizeof(long) and result in a
      total size of 3*sizeof(long).  */
-  arg->size = FFI_ALIGN (arg->size, arg->alignment);
+  size = FFI_ALIGN (size, alignment);
 
   /* On some targets, the ABI defines that structures have an additional
      alignment beyond the "natural" one based on their elements.  */
 #ifdef FFI_AGGREGATE_ALIGNMENT
-  if (FFI_AGGREGATE_ALIGNMENT > arg->alignment)
-    arg->alignment = FFI_AGGREGATE_ALIGNMENT;
+  if (FFI_AGGREGATE_ALIGNMENT > alignment)
+    alignment = FFI_AGGREGATE_ALIGNMENT;
 #endif
 
-  if (arg->size == 0)
+  if (size == 0)
     return FFI_BAD_TYPEDEF;
-  else
-    return FFI_OK;
+
+  TYPE_PUBLISH (arg, size, alignment);
+  return FFI_OK;
 }
 
 #ifndef FFI_TARGET_HAS_VECTOR_TYPE
@@ -238,7 +263,7 @@ ffi_status FFI_HIDDEN ffi_prep_cif_core(ffi_cif *cif, ffi_abi abi,
 #endif
 
   /* Initialize the return type if necessary */
-  if ((cif->rtype->size == 0)
+  if ((TYPE_SIZE(cif->rtype) == 0)
       && (initialize_aggregate(cif->rtype, NULL) != FFI_OK))
     return FFI_BAD_TYPEDEF;
 
@@ -268,7 +293,7 @@ ffi_status FFI_HIDDEN ffi_prep_cif_core(ffi_cif *cif, ffi_abi abi,
     {
 
       /* Initialize any uninitialized aggregate type definitions */
-      if (((*ptr)->size == 0)
+      if ((TYPE_SIZE(*ptr) == 0)
 	  && (initialize_aggregate((*ptr), NULL) != FFI_OK))
 	return FFI_BAD_TYPEDEF;
 
@@ -363,6 +388,41 @@ ffi_prep_closure (ffi_closure* closure,
   return ffi_prep_closure_loc (closure, cif, fun, user_data, closure);
 }
 
+/* Generic closure plan: the x86-64 SysV backend (ffi64.c) keeps a real
+   argument table; everywhere else the plan only remembers the cif and
+   ffi_prep_closure_plan_loc prepares an ordinary closure.  */
+#if !(defined(__x86_64__) && !defined(__ILP32__) && !defined(X86_WIN64))
+
+struct ffi_closure_plan
+{
+  ffi_cif *cif;
+};
+
+ffi_closure_plan *
+ffi_closure_plan_alloc (ffi_cif *cif)
+{
+  ffi_closure_plan *plan = malloc (sizeof (struct ffi_closure_plan));
+  if (plan != NULL)
+    plan->cif = cif;
+  return plan;
+}
+
+void
+ffi_closure_plan_free (ffi_closure_plan *plan)
+{
+  free (plan);
+}
+
+ffi_status
+ffi_prep_closure_plan_loc (ffi_closure *closure, ffi_closure_plan *plan,
+			   void (*fun)(ffi_cif*,void*,void**,void*),
+			   void *user_data, void *codeloc)
+{
+  return ffi_prep_closure_loc (closure, plan->cif, fun, user_data, codeloc);
+}
+
+#endif /* generic ffi_closure_plan */
+
 #endif
 
 ffi_status
@@ -382,13 +442,14 @@ ffi_get_struct_offsets (ffi_abi abi, ffi_type *struct_type, size_t *offsets)
 
 /* Generic ffi_call_plan: a portable fallback compiled on every target that does
    not provide its own accelerated implementation.  The x86-64 SysV backend
-   (ffi64.c) defines these with a fast path under __x86_64__ && !__ILP32__, but
-   that file is not built for Windows x86-64 (X86_WIN64), which uses ffiw64.c
-   instead -- and clang-cl and MSYS/mingw both define __x86_64__ there.  So
-   exclude the fallback only when ffi64.c actually provides it; everywhere else
-   this plan just records the cif and invoke calls ffi_call, so the API is
-   always present and links on all targets.  The cif must outlive the plan. */
-#if !(defined(__x86_64__) && !defined(__ILP32__) && !defined(X86_WIN64))
+   (ffi64.c) defines these with a fast path under __x86_64__ && !__ILP32__;
+   that file is not built for Windows x86-64 (X86_WIN64), where ffiw64.c
+   defines them instead.  The i386 backend (x86/ffi.c) provides its own on
+   every target it builds for.  Everywhere else this plan just records the
+   cif and invoke calls ffi_call, so the API is always present and links on
+   all targets.  The cif must outlive the plan. */
+#if !(defined(__x86_64__) && !defined(__ILP32__)) && !defined(X86_WIN64) \
+  && !(defined(__i386__) || defined(_M_IX86))
 
 struct ffi_call_plan
 {
@@ -404,6 +465,14 @@ ffi_call_plan_alloc (ffi_cif *cif)
   return plan;
 }
 
+ffi_call_plan *
+ffi_call_plan_alloc_flags (ffi_cif *cif, unsigned int flags)
+{
+  /* Every FFI_CALL_PLAN_* option is a hint; none changes behaviour here.  */
+  (void) flags;
+  return ffi_call_plan_alloc (cif);
+}
+
 void
 ffi_call_plan_invoke (ffi_call_plan *plan, void (*fn) (void),
 		      void *rvalue, void **avalue)
@@ -425,3 +494,891 @@ ffi_call_plan_size (ffi_call_plan *plan)
 }
 
 #endif /* generic ffi_call_plan fallback */
+
+/* Interning.
+
+   Interned cifs and types live in hash tables that are only ever added
+   to.  Lookups take no lock where the compiler provides atomics: the
+   bucket array and every chain are published with release stores, and a
+   lookup that misses retries under the lock before creating anything.
+   Growing a table relinks its entries into a larger bucket array; a
+   lookup that races with that may miss, which only sends it to the locked
+   path.  The old bucket arrays are kept, since a lookup may still be
+   reading them.  Entries live until the process exits.  */
+
+#if defined(_WIN32)
+static SRWLOCK intern_mutex = SRWLOCK_INIT;
+#define INTERN_LOCK()	AcquireSRWLockExclusive (&intern_mutex)
+#define INTERN_UNLOCK()	ReleaseSRWLockExclusive (&intern_mutex)
+#elif defined(__unix__) || defined(__APPLE__)
+static pthread_mutex_t intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define INTERN_LOCK()	pthread_mutex_lock (&intern_mutex)
+#define INTERN_UNLOCK()	pthread_mutex_unlock (&intern_mutex)
+#else
+#define INTERN_LOCK()	((void) 0)
+#define INTERN_UNLOCK()	((void) 0)
+#endif
+
+#if defined(__GNUC__)
+#define INTERN_LOCKFREE 1
+#define INTERN_LOAD(x)		__atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#define INTERN_STORE(x, v)	__atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+#else
+#define INTERN_LOAD(x)		(x)
+#define INTERN_STORE(x, v)	((x) = (v))
+#endif
+
+#define INTERN_MIN_BUCKETS 64
+
+/* The head of every interned entry.  */
+struct intern_link
+{
+  struct intern_link *next;
+  size_t hash;
+};
+
+struct intern_table
+{
+  size_t mask;
+  size_t count;
+  struct intern_table *old;
+  struct intern_link *bucket[1];
+};
+
+static size_t
+intern_mix (size_t h, uintptr_t v)
+{
+  /* FNV-1a over whole words; the prime wraps harmlessly on 32-bit.  */
+  return (h ^ (size_t) v) * (size_t) 0x100000001b3ULL;
+}
+
+#define INTERN_SEED ((size_t) 0xcbf29ce484222325ULL)
+
+static size_t
+intern_finish (size_t h)
+{
+  return h ^ (h >> (sizeof (size_t) * 4));
+}
+
+/* The first entry in HASH's chain, or NULL.  */
+
+static struct intern_link *
+intern_chain (struct intern_table *table, size_t hash)
+{
+  if (table == NULL)
+    return NULL;
+  return INTERN_LOAD (table->bucket[hash & table->mask]);
+}
+
+/* Make room for one more entry in *TABLEP, growing it to twice the size
+   when it is full.  Called with the lock held.  Returns NULL when there
+   is no table and none could be allocated.  */
+
+static struct intern_table *
+intern_reserve (struct intern_table **tablep)
+{
+  struct intern_table *table = *tablep, *grown;
+  struct intern_link *e, *next;
+  size_t nbuckets, i, b;
+
+  if (table != NULL && table->count <= table->mask)
+    return table;
+
+  nbuckets = table == NULL ? INTERN_MIN_BUCKETS : (table->mask + 1) * 2;
+  grown = calloc (1, offsetof (struct intern_table, bucket)
+		  + nbuckets * sizeof (struct intern_link *));
+  if (grown == NULL)
+    return table;
+
+  grown->mask = nbuckets - 1;
+  grown->old = table;
+  if (table != NULL)
+    {
+      grown->count = table->count;
+      for (i = 0; i <= table->mask; i++)
+	for (e = table->bucket[i]; e != NULL; e = next)
+	  {
+	    next = e->next;
+	    b = e->hash & grown->mask;
+	    INTERN_STORE (e->next, grown->bucket[b]);
+	    grown->bucket[b] = e;
+	  }
+    }
+  INTERN_STORE (*tablep, grown);
+  return grown;
+}
+
+/* Publish E, whose hash is set, in TABLE.  Called with the lock held.  */
+
+static void
+intern_publish (struct intern_table *table, struct intern_link *e)
+{
+  size_t b = e->hash & table->mask;
+
+  e->next = table->bucket[b];
+  INTERN_STORE (table->bucket[b], e);
+  table->count++;
+}
+
+/* Interned cifs.
+
+   The key is the ABI, the variadic split, the return type and the
+   argument types, all compared by pointer.  The first request for a key
+   prepares a cif over a private copy of the argument type array; every
+   later request returns that same cif.  */
+
+struct cif_intern_entry
+{
+  struct intern_link link;
+  unsigned int isvariadic;
+  unsigned int nfixedargs;
+  ffi_call_plan *plan;
+  ffi_cif cif;
+  /* The argument type array follows.  */
+};
+
+static struct intern_table *cif_intern_table;
+
+#define CIF_INTERN_TYPES(e) ((ffi_type **) ((e) + 1))
+#define CIF_INTERN_ENTRY(c) \
+  ((struct cif_intern_entry *) \
+   ((char *) (c) - offsetof (struct cif_intern_entry, cif)))
+
+static size_t
+cif_intern_hash (ffi_abi abi, unsigned int isvariadic,
+		 unsigned int nfixedargs, unsigned int nargs,
+		 ffi_type *rtype, ffi_type **atypes)
+{
+  size_t h = INTERN_SEED;
+  unsigned int i;
+
+  h = intern_mix (h, (uintptr_t) abi);
+  h = intern_mix (h, isvariadic ? nfixedargs + 1 : 0);
+  h = intern_mix (h, nargs);
+  h = intern_mix (h, (uintptr_t) rtype >> 3);
+  for (i = 0; i < nargs; i++)
+    h = intern_mix (h, (uintptr_t) atypes[i] >> 3);
+  return intern_finish (h);
+}
+
+static struct cif_intern_entry *
+cif_intern_find (struct intern_table *table, size_t hash, ffi_abi abi,
+		 unsigned int isvariadic, unsigned int nfixedargs,
+		 unsigned int nargs, ffi_type *rtype, ffi_type **atypes)
+{
+  struct intern_link *l;
+  struct cif_intern_entry *e;
+  unsigned int i;
+
+  for (l = intern_chain (table, hash); l != NULL; l = INTERN_LOAD (l->next))
+    {
+      e = (struct cif_intern_entry *) l;
+      if (l->hash != hash
+	  || e->cif.abi != abi
+	  || e->cif.nargs != nargs
+	  || e->cif.rtype != rtype
+	  || e->isvariadic != isvariadic
+	  || (isvariadic && e->nfixedargs != nfixedargs))
+	continue;
+      for (i = 0; i < nargs; i++)
+	if (CIF_INTERN_TYPES (e)[i] != atypes[i])
+	  break;
+      if (i == nargs)
+	return e;
+    }
+  return NULL;
+}
+
+/* Find or prepare the cif for a signature.  Called with the lock held.  */
+
+static struct cif_intern_entry *
+cif_intern_insert (size_t hash, ffi_abi abi, unsigned int isvariadic,
+		   unsigned int nfixedargs, unsigned int nargs,
+		   ffi_type *rtype, ffi_type **atypes, ffi_status *status)
+{
+  struct intern_table *table;
+  struct cif_intern_entry *e;
+
+  *status = FFI_OK;
+  e = cif_intern_find (cif_intern_table, hash, abi, isvariadic, nfixedargs,
+		       nargs, rtype, atypes);
+  if (e != NULL)
+    return e;
+
+  table = intern_reserve (&cif_intern_table);
+  if (table == NULL)
+    return NULL;
+
+  e = malloc (sizeof (struct cif_intern_entry) + nargs * sizeof (ffi_type *));
+  if (e == NULL)
+    return NULL;
+
+  if (nargs > 0)
+    memcpy (CIF_INTERN_TYPES (e), atypes, nargs * sizeof (ffi_type *));
+  e->link.hash = hash;
+  e->isvariadic = isvariadic;
+  e->nfixedargs = nfixedargs;
+  e->plan = NULL;
+  if (isvariadic)
+    *status = ffi_prep_cif_var (&e->cif, abi, nfixedargs, nargs, rtype,
+				CIF_INTERN_TYPES (e));
+  else
+    *status = ffi_prep_cif (&e->cif, abi, nargs, rtype, CIF_INTERN_TYPES (e));
+  if (*status != FFI_OK)
+    {
+      free (e);
+      return NULL;
+    }
+
+  intern_publish (table, &e->link);
+  return e;
+}
+
+static ffi_cif *
+cif_intern (ffi_abi abi, unsigned int isvariadic, unsigned int nfixedargs,
+	    unsigned int nargs, ffi_type *rtype, ffi_type **atypes,
+	    ffi_status *status)
+{
+  struct cif_intern_entry *e = NULL;
+  ffi_status rc = FFI_OK;
+  size_t hash;
+
+  if (rtype == NULL || (nargs > 0 && atypes == NULL))
+    rc = FFI_BAD_TYPEDEF;
+  else
+    {
+      hash = cif_intern_hash (abi, isvariadic, nfixedargs, nargs, rtype,
+			      atypes);
+#ifdef INTERN_LOCKFREE
+      e = cif_intern_find (INTERN_LOAD (cif_intern_table), hash, abi,
+			   isvariadic, nfixedargs, nargs, rtype, atypes);
+      if (e == NULL)
+#endif
+	{
+	  INTERN_LOCK ();
+	  e = cif_intern_insert (hash, abi, isvariadic, nfixedargs, nargs,
+				 rtype, atypes, &rc);
+	  INTERN_UNLOCK ();
+	}
+    }
+
+  if (status != NULL)
+    *status = rc;
+  return e != NULL ? &e->cif : NULL;
+}
+
+ffi_cif *
+ffi_cif_intern (ffi_abi abi, unsigned int nargs, ffi_type *rtype,
+		ffi_type **atypes, ffi_status *status)
+{
+  return cif_intern (abi, 0, nargs, nargs, rtype, atypes, status);
+}
+
+ffi_cif *
+ffi_cif_intern_var (ffi_abi abi, unsigned int nfixedargs,
+		    unsigned int ntotalargs, ffi_type *rtype,
+		    ffi_type **atypes, ffi_status *status)
+{
+  return cif_intern (abi, 1, nfixedargs, ntotalargs, rtype, atypes, status);
+}
+
+ffi_call_plan *
+ffi_cif_intern_plan (ffi_cif *cif)
+{
+  struct cif_intern_entry *e = CIF_INTERN_ENTRY (cif);
+  ffi_call_plan *plan;
+
+  plan = INTERN_LOAD (e->plan);
+  if (plan != NULL)
+    return plan;
+
+  /* Build outside the lock; the first plan published wins.  */
+  plan = ffi_call_plan_alloc (cif);
+  if (plan == NULL)
+    return NULL;
+#ifdef INTERN_LOCKFREE
+  {
+    ffi_call_plan *expected = NULL;
+
+    if (!__atomic_compare_exchange_n (&e->plan, &expected, plan, 0,
+				      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      {
+	ffi_call_plan_free (plan);
+	plan = expected;
+      }
+  }
+#else
+  INTERN_LOCK ();
+  if (e->plan == NULL)
+    e->plan = plan;
+  else
+    {
+      ffi_call_plan_free (plan);
+      plan = e->plan;
+    }
+  INTERN_UNLOCK ();
+#endif
+  return plan;
+}
+
+/* Canonical types.
+
+   ffi_type_struct_get and friends return one laid-out ffi_type per
+   structure.  Scalar members are replaced by the built-in type with the
+   same code, size and alignment, and aggregate members by their own
+   canonical type, so two canonical types are structurally identical
+   exactly when they have the same code and the same member pointers.  The
+   hash is computed from the structure alone, never from addresses, so it
+   is the same in every process.  An array is a struct of repeated
+   members, as it is everywhere else in libffi.
+
+   Canonical types are also indexed by address, so that a target can find
+   the word it keeps for a type with ffi_type_abi_cache.  */
+
+struct type_intern_entry
+{
+  struct intern_link link;
+  struct intern_link by_addr;
+  size_t nelem;
+  UINT64 abi_cache;
+  ffi_type type;
+  /* The NULL-terminated element array follows.  */
+};
+
+static struct intern_table *type_intern_table;
+static struct intern_table *type_addr_table;
+
+#define TYPE_INTERN_ELEMENTS(e) ((ffi_type **) ((e) + 1))
+/* The most elements a canonical type can have: an entry with its
+   elements and their terminating NULL must fit in a size_t.  */
+#define TYPE_INTERN_MAX \
+  ((SIZE_MAX - sizeof (struct type_intern_entry)) / sizeof (ffi_type *) - 1)
+#define TYPE_INTERN_ENTRY(t) \
+  ((struct type_intern_entry *) \
+   ((char *) (t) - offsetof (struct type_intern_entry, type)))
+
+/* The built-in type standing for scalar TYPE, or NULL if none does.  */
+
+static ffi_type *
+type_builtin (const ffi_type *type)
+{
+  ffi_type *b;
+
+  switch (type->type)
+    {
+    case FFI_TYPE_UINT8:	b = &ffi_type_uint8; break;
+    case FFI_TYPE_SINT8:	b = &ffi_type_sint8; break;
+    case FFI_TYPE_UINT16:	b = &ffi_type_uint16; break;
+    case FFI_TYPE_SINT16:	b = &ffi_type_sint16; break;
+    case FFI_TYPE_UINT32:	b = &ffi_type_uint32; break;
+    case FFI_TYPE_SINT32:	b = &ffi_type_sint32; break;
+    case FFI_TYPE_UINT64:	b = &ffi_type_uint64; break;
+    case FFI_TYPE_SINT64:	b = &ffi_type_sint64; break;
+    case FFI_TYPE_POINTER:	b = &ffi_type_pointer; break;
+    case FFI_TYPE_FLOAT:	b = &ffi_type_float; break;
+    case FFI_TYPE_DOUBLE:	b = &ffi_type_double; break;
+#if FFI_TYPE_LONGDOUBLE != FFI_TYPE_DOUBLE
+    case FFI_TYPE_LONGDOUBLE:	b = &ffi_type_longdouble; break;
+#endif
+#ifdef FFI_TARGET_HAS_INT128
+    case FFI_TYPE_UINT128:	b = &ffi_type_uint128; break;
+    case FFI_TYPE_SINT128:	b = &ffi_type_sint128; break;
+#endif
+    default:
+      return NULL;
+    }
+  if (b->size != type->size || b->alignment != type->alignment)
+    return NULL;
+  return b;
+}
+
+static ffi_type *type_intern (unsigned short code, ffi_type **elements,
+			      size_t n);
+
+/* The canonical form of TYPE, or NULL if it is malformed.  */
+
+static ffi_type *
+type_canonical (ffi_type *type)
+{
+  ffi_type **p;
+  ffi_type *b;
+  size_t n;
+
+  if (type == NULL)
+    return NULL;
+  if (type->type == FFI_TYPE_STRUCT || type->type == FFI_TYPE_VECTOR)
+    {
+      if (type->elements == NULL)
+	return NULL;
+      for (p = type->elements, n = 0; *p != NULL; p++)
+	n++;
+      return type_intern (type->type, type->elements, n);
+    }
+  if (type->type == FFI_TYPE_VOID)
+    return NULL;
+  b = type_builtin (type);
+  return b != NULL ? b : type;
+}
+
+/* The structural hash of a canonical TYPE.  */
+
+static size_t
+type_addr_hash (const ffi_type *type)
+{
+  return intern_finish (intern_mix (INTERN_SEED, (uintptr_t) type >> 3));
+}
+
+UINT64 *
+ffi_type_abi_cache (ffi_type *type)
+{
+#ifdef INTERN_LOCKFREE
+  struct intern_link *l;
+  struct type_intern_entry *e;
+  size_t hash;
+
+  if (INTERN_LOAD (type_addr_table) == NULL)
+    return NULL;
+  /* A canonical type's elements follow it in its entry.  A hand-built
+     type keeps them elsewhere in all but contrived layouts, so it is
+     turned away here without walking the table; a type that passes is
+     still looked up.  */
+  if ((uintptr_t) type->elements
+      != (uintptr_t) type + (sizeof (struct type_intern_entry)
+			     - offsetof (struct type_intern_entry, type)))
+    return NULL;
+
+  hash = type_addr_hash (type);
+  for (l = intern_chain (INTERN_LOAD (type_addr_table), hash); l != NULL;
+       l = INTERN_LOAD (l->next))
+    {
+      e = (struct type_intern_entry *)
+	((char *) l - offsetof (struct type_intern_entry, by_addr));
+      if (&e->type == type)
+	return &e->abi_cache;
+    }
+#else
+  /* Looking up without the lock needs atomics; go without the cache.  */
+  (void) type;
+#endif
+  return NULL;
+}
+
+static size_t
+type_hash (ffi_type *type)
+{
+  size_t h;
+
+  if (type->type == FFI_TYPE_STRUCT || type->type == FFI_TYPE_VECTOR)
+    return TYPE_INTERN_ENTRY (type)->link.hash;
+  h = intern_mix (INTERN_SEED, type->type);
+  h = intern_mix (h, type->size);
+  return intern_finish (intern_mix (h, type->alignment));
+}
+
+static struct type_intern_entry *
+type_intern_find (struct intern_table *table, size_t hash,
+		  unsigned short code, ffi_type **elements, size_t n)
+{
+  struct intern_link *l;
+  struct type_intern_entry *e;
+  size_t i;
+
+  for (l = intern_chain (table, hash); l != NULL; l = INTERN_LOAD (l->next))
+    {
+      e = (struct type_intern_entry *) l;
+      if (l->hash != hash || e->type.type != code || e->nelem != n)
+	continue;
+      for (i = 0; i < n; i++)
+	if (TYPE_INTERN_ELEMENTS (e)[i] != elements[i])
+	  break;
+      if (i == n)
+	return e;
+    }
+  return NULL;
+}
+
+/* Find or lay out the type with canonical ELEMENTS.  Called with the lock
+   held.  */
+
+static struct type_intern_entry *
+type_intern_insert (size_t hash, unsigned short code, ffi_type **elements,
+		    size_t n)
+{
+  struct intern_table *table, *addr_table;
+  struct type_intern_entry *e;
+
+  FFI_ASSERT (n <= TYPE_INTERN_MAX);
+  e = type_intern_find (type_intern_table, hash, code, elements, n);
+  if (e != NULL)
+    return e;
+
+  table = intern_reserve (&type_intern_table);
+  addr_table = intern_reserve (&type_addr_table);
+  if (table == NULL || addr_table == NULL)
+    return NULL;
+
+  e = malloc (sizeof (struct type_intern_entry)
+	      + (n + 1) * sizeof (ffi_type *));
+  if (e == NULL)
+    return NULL;
+
+  memcpy (TYPE_INTERN_ELEMENTS (e), elements, n * sizeof (ffi_type *));
+  TYPE_INTERN_ELEMENTS (e)[n] = NULL;
+  e->link.hash = hash;
+  e->by_addr.hash = type_addr_hash (&e->type);
+  e->nelem = n;
+  e->abi_cache = 0;
+  e->type.size = 0;
+  e->type.alignment = 0;
+  e->type.type = code;
+  e->type.elements = TYPE_INTERN_ELEMENTS (e);
+  if (initialize_aggregate (&e->type, NULL) != FFI_OK)
+    {
+      free (e);
+      return NULL;
+    }
+
+  intern_publish (addr_table, &e->by_addr);
+  intern_publish (table, &e->link);
+  return e;
+}
+
+static ffi_type *
+type_intern (unsigned short code, ffi_type **elements, size_t n)
+{
+  ffi_type **canon;
+  struct type_intern_entry *e = NULL;
+  size_t hash, i;
+
+  if (n == 0 || n > TYPE_INTERN_MAX || elements == NULL)
+    return NULL;
+
+  canon = malloc (n * sizeof (ffi_type *));
+  if (canon == NULL)
+    return NULL;
+
+  hash = intern_mix (INTERN_SEED, code);
+  hash = intern_mix (hash, n);
+  for (i = 0; i < n; i++)
+    {
+      canon[i] = type_canonical (elements[i]);
+      if (canon[i] == NULL)
+	goto out;
+      hash = intern_mix (hash, type_hash (canon[i]));
+    }
+  hash = intern_finish (hash);
+
+#ifdef INTERN_LOCKFREE
+  e = type_intern_find (INTERN_LOAD (type_intern_table), hash, code, canon,
+			n);
+  if (e == NULL)
+#endif
+    {
+      INTERN_LOCK ();
+      e = type_intern_insert (hash, code, canon, n);
+      INTERN_UNLOCK ();
+    }
+
+ out:
+  free (canon);
+  return e != NULL ? &e->type : NULL;
+}
+
+ffi_type *
+ffi_type_struct_get (ffi_type **elements, size_t n)
+{
+  return type_intern (FFI_TYPE_STRUCT, elements, n);
+}
+
+/* The type of N repetitions of ELEMENT.  */
+
+static ffi_type *
+type_intern_repeat (unsigned short code, ffi_type *element, size_t n)
+{
+  ffi_type **elements;
+  ffi_type *type;
+  size_t i;
+
+  if (n == 0 || n > TYPE_INTERN_MAX || element == NULL)
+    return NULL;
+  elements = malloc (n * sizeof (ffi_type *));
+  if (elements == NULL)
+    return NULL;
+  for (i = 0; i < n; i++)
+    elements[i] = element;
+  type = type_intern (code, elements, n);
+  free (elements);
+  return type;
+}
+
+ffi_type *
+ffi_type_array_get (ffi_type *element, size_t n)
+{
+  return type_intern_repeat (FFI_TYPE_STRUCT, element, n);
+}
+
+ffi_type *
+ffi_type_vector_get (ffi_type *lane, size_t n)
+{
+  return type_intern_repeat (FFI_TYPE_VECTOR, lane, n);
+}
+
+/* Batch preparation.
+
+   ffi_prep_cif_batch prepares each distinct signature in an array once.
+   Identical descriptors, compared like ffi_cif_intern keys, share a cif.
+   The cifs and their argument type arrays are carved from one block, so
+   that they sit together and are released at once; plans come from their
+   target's allocator and are released with the batch.  Signatures may be
+   shared out among threads, which is safe because laying out a shared
+   type is (see TYPE_PUBLISH).  */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BATCH_THREADS 1
+#endif
+
+struct ffi_cif_batch
+{
+  size_t ncifs;
+  ffi_cif *cifs;
+  ffi_call_plan **plans;
+};
+
+struct batch_work
+{
+  const ffi_cif_desc *descs;
+  const size_t *rep;		/* descriptor index for each cif */
+  ffi_status *status;		/* one per cif */
+  ffi_type **types;		/* the argument type arrays, in cif order */
+  size_t *type_offset;		/* where each cif's array starts in TYPES */
+  ffi_cif_batch *batch;
+  unsigned int nthreads;
+  unsigned int thread;
+};
+
+static int
+batch_desc_equal (const ffi_cif_desc *a, const ffi_cif_desc *b)
+{
+  unsigned int i;
+
+  if (a->abi != b->abi || a->nargs != b->nargs || a->rtype != b->rtype
+      || (a->variadic != 0) != (b->variadic != 0)
+      || (a->variadic && a->nfixedargs != b->nfixedargs))
+    return 0;
+  for (i = 0; i < a->nargs; i++)
+    if (a->atypes[i] != b->atypes[i])
+      return 0;
+  return 1;
+}
+
+static size_t
+batch_desc_hash (const ffi_cif_desc *d)
+{
+  return cif_intern_hash (d->abi, d->variadic != 0, d->nfixedargs, d->nargs,
+			  d->rtype, d->atypes);
+}
+
+/* Prepare the cifs this worker is responsible for.  */
+
+static void *
+batch_prepare (void *arg)
+{
+  struct batch_work *w = arg;
+  ffi_cif_batch *batch = w->batch;
+  const ffi_cif_desc *d;
+  ffi_type **atypes;
+  size_t k;
+
+  for (k = w->thread; k < batch->ncifs; k += w->nthreads)
+    {
+      d = &w->descs[w->rep[k]];
+      atypes = w->types + w->type_offset[k];
+      if (d->rtype == NULL || (d->nargs > 0 && d->atypes == NULL))
+	{
+	  w->status[k] = FFI_BAD_TYPEDEF;
+	  continue;
+	}
+      if (d->nargs > 0)
+	memcpy (atypes, d->atypes, d->nargs * sizeof (ffi_type *));
+      if (d->variadic)
+	w->status[k] = ffi_prep_cif_var (&batch->cifs[k], d->abi,
+					 d->nfixedargs, d->nargs, d->rtype,
+					 atypes);
+      else
+	w->status[k] = ffi_prep_cif (&batch->cifs[k], d->abi, d->nargs,
+				     d->rtype, atypes);
+      if (w->status[k] == FFI_OK && batch->plans != NULL)
+	batch->plans[k] = ffi_call_plan_alloc (&batch->cifs[k]);
+    }
+  return NULL;
+}
+
+/* Run batch_prepare on up to NTHREADS threads, the caller included.  */
+
+static void
+batch_run (struct batch_work *w, unsigned int nthreads)
+{
+#ifdef BATCH_THREADS
+  struct batch_work *works;
+  pthread_t *threads;
+  unsigned int t, started;
+
+  if (nthreads > w->batch->ncifs)
+    nthreads = (unsigned int) w->batch->ncifs;
+  if (nthreads > 1)
+    {
+      works = malloc (nthreads * sizeof (struct batch_work));
+      threads = malloc (nthreads * sizeof (pthread_t));
+      if (works != NULL && threads != NULL)
+	{
+	  for (t = 0; t < nthreads; t++)
+	    {
+	      works[t] = *w;
+	      works[t].nthreads = nthreads;
+	      works[t].thread = t;
+	    }
+	  /* A thread that cannot be started leaves its share to us.  */
+	  for (started = 1; started < nthreads; started++)
+	    if (pthread_create (&threads[started], NULL, batch_prepare,
+				&works[started]) != 0)
+	      break;
+	  batch_prepare (&works[0]);
+	  for (t = 1; t < started; t++)
+	    pthread_join (threads[t], NULL);
+	  for (t = started; t < nthreads; t++)
+	    batch_prepare (&works[t]);
+	  free (works);
+	  free (threads);
+	  return;
+	}
+      free (works);
+      free (threads);
+    }
+#else
+  (void) nthreads;
+#endif
+  w->nthreads = 1;
+  w->thread = 0;
+  batch_prepare (w);
+}
+
+ffi_cif_batch *
+ffi_prep_cif_batch (const ffi_cif_desc *descs, size_t n, ffi_cif **cifs,
+		    ffi_call_plan **plans, ffi_status *status,
+		    unsigned int nthreads)
+{
+  struct batch_work w;
+  ffi_cif_batch *batch = NULL;
+  size_t *slots = NULL, *map = NULL, *rep = NULL, *type_offset = NULL;
+  ffi_status *cif_status = NULL;
+  size_t nslots, ncifs, ntypes, i, j, k, bytes;
+  char *p;
+
+  /* Find the distinct signatures: SLOTS is an open-addressed table of
+     cif numbers plus one, MAP gives each descriptor's cif, and REP each
+     cif's first descriptor.  */
+  for (nslots = 16; nslots < n * 2; nslots <<= 1)
+    ;
+  slots = calloc (nslots, sizeof (size_t));
+  map = malloc ((n + 1) * sizeof (size_t));
+  rep = malloc ((n + 1) * sizeof (size_t));
+  if (slots == NULL || map == NULL || rep == NULL)
+    goto out;
+
+  ncifs = 0;
+  for (i = 0; i < n; i++)
+    {
+      /* Malformed descriptors get a cif of their own to fail in.  */
+      if (descs[i].rtype == NULL
+	  || (descs[i].nargs > 0 && descs[i].atypes == NULL))
+	{
+	  rep[ncifs] = i;
+	  map[i] = ncifs++;
+	  continue;
+	}
+      for (j = batch_desc_hash (&descs[i]) & (nslots - 1); slots[j] != 0;
+	   j = (j + 1) & (nslots - 1))
+	if (batch_desc_equal (&descs[rep[slots[j] - 1]], &descs[i]))
+	  break;
+      if (slots[j] == 0)
+	{
+	  rep[ncifs] = i;
+	  slots[j] = ++ncifs;
+	}
+      map[i] = slots[j] - 1;
+    }
+
+  type_offset = malloc ((ncifs + 1) * sizeof (size_t));
+  cif_status = malloc ((ncifs + 1) * sizeof (ffi_status));
+  if (type_offset == NULL || cif_status == NULL)
+    goto out;
+  for (k = 0, ntypes = 0; k < ncifs; k++)
+    {
+      type_offset[k] = ntypes;
+      ntypes += descs[rep[k]].nargs;
+    }
+
+  /* The batch header, the cifs, the plan pointers and the argument type
+     arrays, in one block.  */
+  bytes = FFI_ALIGN (sizeof (ffi_cif_batch), sizeof (void *))
+    + ncifs * sizeof (ffi_cif)
+    + (plans != NULL ? ncifs * sizeof (ffi_call_plan *) : 0)
+    + ntypes * sizeof (ffi_type *);
+  batch = calloc (1, bytes);
+  if (batch == NULL)
+    goto out;
+  p = (char *) batch + FFI_ALIGN (sizeof (ffi_cif_batch), sizeof (void *));
+  batch->ncifs = ncifs;
+  batch->cifs = (ffi_cif *) p;
+  p += ncifs * sizeof (ffi_cif);
+  if (plans != NULL)
+    {
+      batch->plans = (ffi_call_plan **) p;
+      p += ncifs * sizeof (ffi_call_plan *);
+    }
+
+  w.descs = descs;
+  w.rep = rep;
+  w.status = cif_status;
+  w.types = (ffi_type **) p;
+  w.type_offset = type_offset;
+  w.batch = batch;
+  batch_run (&w, nthreads);
+
+  for (i = 0; i < n; i++)
+    {
+      k = map[i];
+      if (status != NULL)
+	status[i] = cif_status[k];
+      cifs[i] = cif_status[k] == FFI_OK ? &batch->cifs[k] : NULL;
+      if (plans != NULL)
+	plans[i] = cif_status[k] == FFI_OK ? batch->plans[k] : NULL;
+    }
+
+ out:
+  free (slots);
+  free (map);
+  free (rep);
+  free (type_offset);
+  free (cif_status);
+  return batch;
+}
+
+void
+ffi_cif_batch_free (ffi_cif_batch *batch)
+{
+  size_t k;
+
+  if (batch == NULL)
+    return;
+  if (batch->plans != NULL)
+    for (k = 0; k < batch->ncifs; k++)
+      ffi_call_plan_free (batch->plans[k]);
+  free (batch);
+}
+
+size_t
+ffi_cif_batch_size (ffi_cif_batch *batch)
+{
+  return batch != NULL ? batch->ncifs : 0;
+}
@@ -47,6 +47,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <sys/mman.h>
@@ -58,6 +59,10 @@
 #ifdef __CYGWIN__
 #include <limits.h>
 #endif
+#if defined (__linux__) && defined (HAVE_DL_ITERATE_PHDR)
+#include <link.h>
+#define TRAMP_DL_ITERATE_PHDR 1
+#endif
 #endif
 
 /*
@@ -81,24 +86,41 @@ struct tramp;
  * Trampoline table. Manages one trampoline code table and one trampoline
  * parameter table.
  *
- * prev, next	Links in the global trampoline table list.
+ * Trampolines are allocated and freed without taking tramp_globals_mutex.
+ * A trampoline is free when its bit in the free bitmap is set. nfree
+ * counts the free trampolines and acts as a semaphore: an allocator first
+ * reserves trampolines by decrementing nfree, and only then clears bits,
+ * so a reservation always finds a set bit. A free sets the bit before it
+ * increments nfree.
+ *
+ * A table whose trampolines are all free can be unmapped. It is marked
+ * TRAMP_TABLE_DEAD, which no reservation can succeed against, and stays
+ * in the global list to be mapped again later. Table structures are never
+ * released, so the list can be walked without a lock.
+ *
+ * next		Link in the global trampoline table list.
+ * slot		Address range reserved for this table in the region set
+ *		aside by LIBFFI_TRAMP_RESERVE, or NULL.
  * code_table	Trampoline code table mapping.
  * parm_table	Trampoline parameter table mapping.
  * array	Array of trampolines malloced.
- * free		List of free trampolines.
- * nfree	Number of free trampolines.
+ * free		Bitmap of free trampolines.
+ * nfree	Number of free trampolines, or TRAMP_TABLE_DEAD.
  */
 struct tramp_table
 {
-  struct tramp_table *prev;
   struct tramp_table *next;
+  char *slot;
   void *code_table;
   void *parm_table;
   struct tramp *array;
-  struct tramp *free;
+  unsigned long *free;
   int nfree;
 };
 
+#define TRAMP_TABLE_DEAD	(-1)
+#define TRAMP_BITS		(8 * sizeof (unsigned long))
+
 /*
  * Parameters for each trampoline.
  *
@@ -116,7 +138,6 @@ struct tramp_parm
 /*
  * Trampoline structure for each trampoline.
  *
- * prev, next	Links in the trampoline free list of a trampoline table.
  * table	Trampoline table to which this trampoline belongs.
  * code		Address of this trampoline in the code table mapping.
  * parm		Address of this trampoline's parameters in the parameter
@@ -124,8 +145,6 @@ struct tramp_parm
  */
 struct tramp
 {
-  struct tramp *prev;
-  struct tramp *next;
   struct tramp_table *table;
   void *code;
   struct tramp_parm *parm;
@@ -152,10 +171,24 @@ enum tramp_globals_status {
  *	Size of one trampoline in the trampoline code table.
  * ntramp
  *	Total number of trampolines in the trampoline code table.
- * free_tables
- *	List of trampoline tables that contain free trampolines.
- * nfree_tables
- *	Number of trampoline tables that contain free trampolines.
+ * nwords
+ *	Number of words in the free bitmap of a trampoline table.
+ * tables
+ *	List of all trampoline tables, mapped or dead, newest first.
+ * hint
+ *	Table that most recently had free trampolines; searches start there.
+ * reserve
+ *	Region reserved up front for trampoline tables, or NULL.
+ * nreserve
+ *	Number of tables the reserved region has room for.
+ * nreserved
+ *	Number of tables given a slot in the reserved region so far.
+ * map_flags
+ *	Extra mmap flags for trampoline table mappings.
+ * keep
+ *	Number of completely free tables kept mapped (LIBFFI_TRAMP_KEEP).
+ * nmaps, nunmaps
+ *	Number of times a trampoline table was mapped and unmapped.
  * status
  *	Initialization status.
  */
@@ -167,8 +200,16 @@ struct tramp_globals
   size_t map_size;
   size_t size;
   int ntramp;
-  struct tramp_table *free_tables;
-  int nfree_tables;
+  int nwords;
+  struct tramp_table *tables;
+  struct tramp_table *hint;
+  char *reserve;
+  size_t nreserve;
+  size_t nreserved;
+  int map_flags;
+  unsigned int keep;
+  size_t nmaps;
+  size_t nunmaps;
   enum tramp_globals_status status;
 };
 
@@ -180,11 +221,14 @@ static struct tramp_globals tramp_globals;
  * The trampoline file is the file used to map the trampoline code table into
  * the address space of a process. There are two ways to get this file:
  *
- * - From the OS. E.g., on Linux, /proc/<pid>/maps lists all the memory
- *   mappings for <pid>. For file-backed mappings, maps supplies the file name
- *   and the file offset. Using this, we can locate the mapping that maps
- *   libffi and get the path to the libffi binary. And, we can compute the
- *   offset of the trampoline code table within that binary.
+ * - From the OS. The dynamic linker knows which object holds the code
+ *   table and where that object's loadable segments come from in its file,
+ *   so dl_iterate_phdr () gives the path to the libffi binary and the
+ *   offset of the trampoline code table within it without any I/O. Failing
+ *   that, on Linux, /proc/<pid>/maps lists all the memory mappings for
+ *   <pid>, and for file-backed mappings supplies the file name and the file
+ *   offset. Either way, the file is checked to hold the code table at that
+ *   offset before it is used.
  *
  * - Else, if we can create a temporary file, we can write the trampoline code
  *   table from the text segment into the temporary file.
@@ -205,24 +249,81 @@ static int tramp_table_alloc (void);
 #define FFI_TRAMP_STR_(x) #x
 #define FFI_TRAMP_STR(x)  FFI_TRAMP_STR_(x)
 
+#ifdef TRAMP_DL_ITERATE_PHDR
+
+/*
+ * What tramp_find_object () is looking for, and what it found.
+ */
+struct tramp_object
+{
+  uintptr_t addr;
+  char *file;
+  size_t file_size;
+  off_t offset;
+};
+
 static int
-ffi_tramp_get_libffi (void)
+tramp_find_object (struct dl_phdr_info *info,
+		   size_t size __attribute__((unused)), void *data)
+{
+  struct tramp_object *obj = data;
+  const char *name;
+  int i;
+
+  for (i = 0; i < info->dlpi_phnum; i++)
+    {
+      const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+      uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+
+      if (phdr->p_type != PT_LOAD
+	  || obj->addr < start || obj->addr >= start + phdr->p_filesz)
+	continue;
+
+      /* The main program has no name here.  */
+      name = info->dlpi_name;
+      if (name == NULL || name[0] == '\0')
+	name = "/proc/self/exe";
+      if (strlen (name) >= obj->file_size)
+	return -1;
+      strcpy (obj->file, name);
+      obj->offset = phdr->p_offset + (obj->addr - start);
+      return 1;
+    }
+  return 0;
+}
+
+/*
+ * Ask the dynamic linker for the file and offset of the code table.
+ */
+static int
+tramp_locate_dl (char *file, size_t file_size, off_t *offset)
+{
+  struct tramp_object obj;
+
+  obj.addr = (uintptr_t) tramp_globals.text;
+  obj.file = file;
+  obj.file_size = file_size;
+  if (dl_iterate_phdr (tramp_find_object, &obj) != 1)
+    return 0;
+  *offset = obj.offset;
+  return 1;
+}
+
+#endif /* TRAMP_DL_ITERATE_PHDR */
+
+/*
+ * Look the code table up in /proc/<pid>/maps.
+ */
+static int
+tramp_locate_maps (char *file, off_t *offset)
 {
   FILE *fp;
-  /* `file' is sized PATH_MAX+1 so a scanf field width of PATH_MAX
-     (which permits PATH_MAX characters plus the terminating NUL) cannot
-     overflow.  */
-  char file[PATH_MAX+1], line[PATH_MAX+100], perm[10], dev[10];
-  unsigned long start, end, offset, inode;
+  char line[PATH_MAX+100], perm[10], dev[10];
+  unsigned long start, end, map_offset, inode;
   uintptr_t addr = (uintptr_t) tramp_globals.text;
   int nfields, found;
-  int open_flags = O_RDONLY;
-
-#ifdef O_CLOEXEC
-  open_flags |= O_CLOEXEC;
-#endif
 
-  snprintf (file, sizeof (file), "/proc/%d/maps", getpid());
+  snprintf (file, PATH_MAX + 1, "/proc/%d/maps", getpid());
   fp = fopen (file, "r");
   if (fp == NULL)
     return 0;
@@ -236,36 +337,75 @@ ffi_tramp_get_libffi (void)
        the fixed-size `file' buffer.  */
     nfields = sscanf (line,
       "%lx-%lx %9s %lx %9s %ld %" FFI_TRAMP_STR(PATH_MAX) "s",
-      &start, &end, perm, &offset, dev, &inode, file);
+      &start, &end, perm, &map_offset, dev, &inode, file);
     if (nfields != 7)
       continue;
 
     if (addr >= start && addr < end) {
-      tramp_globals.offset = offset + (addr - start);
+      *offset = map_offset + (addr - start);
       found = 1;
       break;
     }
   }
   fclose (fp);
+  return found;
+}
 
-  if (!found)
-    return 0;
+/*
+ * Open FILE and make sure it holds the trampoline code table at OFFSET, so
+ * that a stale path can never map the wrong code. Then allocate a
+ * trampoline table to make sure that the code table can be mapped.
+ */
+static int
+tramp_use_file (const char *file, off_t offset)
+{
+  char buf[256];
+  size_t done, n;
+  int open_flags = O_RDONLY;
+
+#ifdef O_CLOEXEC
+  open_flags |= O_CLOEXEC;
+#endif
 
   tramp_globals.fd = open (file, open_flags);
   if (tramp_globals.fd == -1)
     return 0;
 
-  /*
-   * Allocate a trampoline table just to make sure that the trampoline code
-   * table can be mapped.
-   */
-  if (!tramp_table_alloc ())
+  for (done = 0; done < tramp_globals.map_size; done += n)
     {
-      close (tramp_globals.fd);
-      tramp_globals.fd = -1;
-      return 0;
+      n = tramp_globals.map_size - done;
+      if (n > sizeof (buf))
+	n = sizeof (buf);
+      if (pread (tramp_globals.fd, buf, n, offset + done) != (ssize_t) n
+	  || memcmp (buf, (char *) tramp_globals.text + done, n) != 0)
+	goto fail;
     }
-  return 1;
+
+  tramp_globals.offset = offset;
+  if (tramp_table_alloc ())
+    return 1;
+
+ fail:
+  close (tramp_globals.fd);
+  tramp_globals.fd = -1;
+  return 0;
+}
+
+static int
+ffi_tramp_get_libffi (void)
+{
+  /* `file' is sized PATH_MAX+1 so a scanf field width of PATH_MAX
+     (which permits PATH_MAX characters plus the terminating NUL) cannot
+     overflow.  */
+  char file[PATH_MAX+1];
+  off_t offset;
+
+#ifdef TRAMP_DL_ITERATE_PHDR
+  if (tramp_locate_dl (file, sizeof (file), &offset)
+      && tramp_use_file (file, offset))
+    return 1;
+#endif
+  return tramp_locate_maps (file, &offset) && tramp_use_file (file, offset);
 }
 
 #endif /* defined (__linux__) || defined (__CYGWIN__) */
@@ -327,6 +467,19 @@ ffi_tramp_unlock(void)
   pthread_mutex_unlock (&tramp_globals_mutex);
 }
 
+/*
+ * A forked child inherits the trampoline file descriptor, the code table
+ * offset and the tables, so it never has to look for the trampoline file
+ * again. Hold the lock across fork () so that the child also inherits all
+ * of that in a consistent state rather than a lock owned by a thread that
+ * does not exist in the child.
+ */
+static void
+ffi_tramp_init_fork (void)
+{
+  (void) pthread_atfork (ffi_tramp_lock, ffi_tramp_unlock, ffi_tramp_unlock);
+}
+
 #endif /* defined (__linux__) || defined (__CYGWIN__) */
 
 /* ------------------------ OS-specific Memory Mapping ----------------------*/
@@ -348,28 +501,121 @@ ffi_tramp_unlock(void)
 
 #if defined (__linux__) || defined (__CYGWIN__)
 
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/*
+ * Closure-heavy processes can ask for trampoline tables to be carved out of
+ * one region reserved up front, instead of mapping each table separately:
+ *
+ * LIBFFI_TRAMP_RESERVE=<n>
+ *	Reserve address space for <n> trampoline tables. The region is mapped
+ *	PROT_NONE, and each table is made accessible only when it is carved
+ *	out; it keeps its addresses when it is unmapped and mapped again, and
+ *	sits next to the other tables. Tables beyond <n> are mapped separately
+ *	as usual.
+ *
+ * LIBFFI_TRAMP_POPULATE=1
+ *	Pre-fault trampoline tables (MAP_POPULATE) as they are mapped, so that
+ *	creating and first calling a closure does not take page faults.
+ *
+ * LIBFFI_TRAMP_KEEP=<k>
+ *	Keep up to <k> completely free tables mapped, so that bursts of
+ *	closure allocation and release do not map and unmap a table each time.
+ *
+ * The code table is file-backed and each parameter table must directly
+ * follow its code table, so tables cannot share huge pages.
+ */
+static void
+tramp_table_config (void)
+{
+  const char *value;
+  unsigned long n;
+  size_t size = tramp_globals.map_size * 2;
+  void *addr;
+
+  value = getenv ("LIBFFI_TRAMP_KEEP");
+  if (value != NULL)
+    tramp_globals.keep = (unsigned int) strtoul (value, NULL, 0);
+
+  value = getenv ("LIBFFI_TRAMP_POPULATE");
+  if (value != NULL && *value != '\0' && *value != '0')
+    tramp_globals.map_flags = MAP_POPULATE;
+
+  value = getenv ("LIBFFI_TRAMP_RESERVE");
+  if (value == NULL)
+    return;
+  n = strtoul (value, NULL, 0);
+  if (n == 0 || n > (size_t) -1 / size)
+    return;
+
+  /*
+   * Only address space is reserved: nothing in the region can be read,
+   * written or executed until a table is carved out of it.
+   */
+  addr = mmap (NULL, n * size, PROT_NONE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED)
+    return;
+
+  tramp_globals.reserve = addr;
+  tramp_globals.nreserve = n;
+}
+
 static int
 tramp_table_map (struct tramp_table *table)
 {
   char *addr;
 
   /*
-   * Create an anonymous mapping twice the map size. The top half will be used
-   * for the code table. The bottom half will be used for the parameter table.
+   * Tables keep their slot in the reserved region for life.
    */
-  addr = mmap (NULL, tramp_globals.map_size * 2, PROT_READ | PROT_WRITE,
-    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (addr == MAP_FAILED)
-    return 0;
+  if (table->slot == NULL && tramp_globals.nreserved < tramp_globals.nreserve)
+    table->slot = tramp_globals.reserve
+      + tramp_globals.nreserved++ * tramp_globals.map_size * 2;
+
+  if (table->slot != NULL)
+    {
+      /*
+       * Make the bottom half of the slot the parameter table.
+       */
+      addr = table->slot;
+      if (mmap (addr + tramp_globals.map_size, tramp_globals.map_size,
+	    PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | tramp_globals.map_flags,
+	    -1, 0) == MAP_FAILED)
+	return 0;
+    }
+  else
+    {
+      /*
+       * Create an anonymous mapping twice the map size. The top half will be
+       * used for the code table. The bottom half will be used for the
+       * parameter table.
+       */
+      addr = mmap (NULL, tramp_globals.map_size * 2, PROT_READ | PROT_WRITE,
+	MAP_PRIVATE | MAP_ANONYMOUS | tramp_globals.map_flags, -1, 0);
+      if (addr == MAP_FAILED)
+	return 0;
+    }
 
   /*
    * Replace the top half of the anonymous mapping with the code table mapping.
    */
   table->code_table = mmap (addr, tramp_globals.map_size, PROT_READ | PROT_EXEC,
-    MAP_PRIVATE | MAP_FIXED, tramp_globals.fd, tramp_globals.offset);
+    MAP_PRIVATE | MAP_FIXED | tramp_globals.map_flags, tramp_globals.fd,
+    tramp_globals.offset);
   if (table->code_table == MAP_FAILED)
     {
-      (void) munmap (addr, tramp_globals.map_size * 2);
+      if (table->slot == NULL)
+	(void) munmap (addr, tramp_globals.map_size * 2);
+      else
+	(void) mmap (addr, tramp_globals.map_size * 2, PROT_NONE,
+	  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
       return 0;
     }
   table->parm_table = table->code_table + tramp_globals.map_size;
@@ -379,14 +625,36 @@ tramp_table_map (struct tramp_table *table)
 static void
 tramp_table_unmap (struct tramp_table *table)
 {
-  (void) munmap (table->code_table, tramp_globals.map_size);
-  (void) munmap (table->parm_table, tramp_globals.map_size);
+  if (table->slot == NULL)
+    {
+      (void) munmap (table->code_table, tramp_globals.map_size);
+      (void) munmap (table->parm_table, tramp_globals.map_size);
+      return;
+    }
+
+  /*
+   * Give the slot back to the reserved region: drop the code table mapping
+   * and the parameter pages, but keep the address range, inaccessible.
+   */
+  (void) mmap (table->slot, tramp_globals.map_size * 2, PROT_NONE,
+    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
 }
 
 #endif /* defined (__linux__) || defined (__CYGWIN__) */
 
 /* ------------------------ Trampoline Initialization ----------------------*/
 
+/*
+ * Publish the initialization status. Once it is no longer
+ * TRAMP_GLOBALS_UNINITIALIZED, ffi_tramp_is_supported () reads it without
+ * the lock, so everything set up before it must be visible first.
+ */
+static void
+tramp_set_status (enum tramp_globals_status status)
+{
+  __atomic_store_n (&tramp_globals.status, status, __ATOMIC_RELEASE);
+}
+
 /*
  * Initialize the static trampoline feature.
  */
@@ -403,12 +671,19 @@ ffi_tramp_init (void)
 
   if (ffi_tramp_arch == NULL)
     {
-      tramp_globals.status = TRAMP_GLOBALS_FAILED;
+      tramp_set_status (TRAMP_GLOBALS_FAILED);
       return 0;
     }
 
-  tramp_globals.free_tables = NULL;
-  tramp_globals.nfree_tables = 0;
+  tramp_globals.tables = NULL;
+  tramp_globals.hint = NULL;
+  tramp_globals.reserve = NULL;
+  tramp_globals.nreserve = 0;
+  tramp_globals.nreserved = 0;
+  tramp_globals.map_flags = 0;
+  tramp_globals.keep = 0;
+  tramp_globals.nmaps = 0;
+  tramp_globals.nunmaps = 0;
 
   /*
    * Get trampoline code table information from the architecture.
@@ -416,6 +691,7 @@ ffi_tramp_init (void)
   tramp_globals.text = ffi_tramp_arch (&tramp_globals.size,
     &tramp_globals.map_size);
   tramp_globals.ntramp = tramp_globals.map_size / tramp_globals.size;
+  tramp_globals.nwords = (tramp_globals.ntramp + TRAMP_BITS - 1) / TRAMP_BITS;
 
   /*
    * The trampoline code table is a single, fixed-size mapping.  If the
@@ -427,17 +703,23 @@ ffi_tramp_init (void)
   page_size = sysconf (_SC_PAGESIZE);
   if (page_size >= 0 && (size_t)page_size > tramp_globals.map_size)
     {
-      tramp_globals.status = TRAMP_GLOBALS_FAILED;
+      tramp_set_status (TRAMP_GLOBALS_FAILED);
       return 0;
     }
 
+  tramp_table_config ();
+
   if (ffi_tramp_init_os ())
     {
-      tramp_globals.status = TRAMP_GLOBALS_PASSED;
+      ffi_tramp_init_fork ();
+      tramp_set_status (TRAMP_GLOBALS_PASSED);
       return 1;
     }
 
-  tramp_globals.status = TRAMP_GLOBALS_FAILED;
+  if (tramp_globals.reserve != NULL)
+    (void) munmap (tramp_globals.reserve,
+      tramp_globals.nreserve * tramp_globals.map_size * 2);
+  tramp_set_status (TRAMP_GLOBALS_FAILED);
   return 0;
 }
 
@@ -445,26 +727,73 @@ ffi_tramp_init (void)
 
 /* This code assumes that malloc () is available on all OSes. */
 
-static void tramp_add (struct tramp *tramp);
-
 /*
- * Allocate and initialize a trampoline table.
+ * Map TABLE, which must be dead, and make all its trampolines free.
  */
 static int
-tramp_table_alloc (void)
+tramp_table_revive (struct tramp_table *table)
 {
-  struct tramp_table *table;
-  struct tramp *tramp_array, *tramp;
   size_t size;
   char *code, *parm;
   int i;
 
+  /*
+   * Map a code table and a parameter table into the caller's address space.
+   */
+  if (!tramp_table_map (table))
+    return 0;
+
+  size = tramp_globals.size;
+  code = table->code_table;
+  parm = table->parm_table;
+  for (i = 0; i < tramp_globals.ntramp; i++)
+    {
+      table->array[i].code = code;
+      table->array[i].parm = (struct tramp_parm *) parm;
+      code += size;
+      parm += size;
+    }
+  for (i = 0; i < tramp_globals.nwords; i++)
+    table->free[i] = ~0UL;
+  if (tramp_globals.ntramp % TRAMP_BITS != 0)
+    table->free[i - 1] = (1UL << (tramp_globals.ntramp % TRAMP_BITS)) - 1;
+
+  /*
+   * Publish the trampolines: reservations acquire nfree.
+   */
+  __atomic_store_n (&table->nfree, tramp_globals.ntramp, __ATOMIC_RELEASE);
+  __atomic_store_n (&tramp_globals.hint, table, __ATOMIC_RELEASE);
+  tramp_globals.nmaps++;
+  return 1;
+}
+
+/*
+ * Make sure that a trampoline table with free trampolines exists, mapping a
+ * dead table again or allocating a new one if needed. Called with the lock
+ * held; this is the only serialized step of trampoline allocation.
+ */
+static int
+tramp_table_alloc (void)
+{
+  struct tramp_table *table, *dead = NULL;
+  struct tramp *tramp_array;
+  int i, nfree;
+
   /*
    * If we already have tables with free trampolines, there is no need to
    * allocate a new table.
    */
-  if (tramp_globals.nfree_tables > 0)
-    return 1;
+  for (table = tramp_globals.tables; table != NULL; table = table->next)
+    {
+      nfree = __atomic_load_n (&table->nfree, __ATOMIC_RELAXED);
+      if (nfree > 0)
+	return 1;
+      if (nfree == TRAMP_TABLE_DEAD && dead == NULL)
+	dead = table;
+    }
+
+  if (dead != NULL)
+    return tramp_table_revive (dead);
 
   /*
    * Allocate a new trampoline table structure.
@@ -474,50 +803,29 @@ tramp_table_alloc (void)
     return 0;
 
   /*
-   * Allocate new trampoline structures.
+   * Allocate new trampoline structures and the free bitmap.
    */
-  tramp_array = malloc (sizeof (*tramp) * tramp_globals.ntramp);
+  tramp_array = malloc (sizeof (*tramp_array) * tramp_globals.ntramp);
   if (tramp_array == NULL)
     goto free_table;
+  table->free = malloc (sizeof (*table->free) * tramp_globals.nwords);
+  if (table->free == NULL)
+    goto free_tramp_array;
 
-  /*
-   * Map a code table and a parameter table into the caller's address space.
-   */
-  if (!tramp_table_map (table))
-    {
-      /*
-       * Failed to map the code and parameter tables.
-       */
-      goto free_tramp_array;
-    }
-
-  /*
-   * Initialize the trampoline table.
-   */
   table->array = tramp_array;
-  table->free = NULL;
-  table->nfree = 0;
+  table->slot = NULL;
+  for (i = 0; i < tramp_globals.ntramp; i++)
+    tramp_array[i].table = table;
+  table->nfree = TRAMP_TABLE_DEAD;
 
   /*
-   * Populate the trampoline table free list. This will also add the trampoline
-   * table to the global list of trampoline tables.
+   * Add the table to the global list. Even if it cannot be mapped now, it
+   * stays there as a dead table.
    */
-  size = tramp_globals.size;
-  code = table->code_table;
-  parm = table->parm_table;
-  for (i = 0; i < tramp_globals.ntramp; i++)
-    {
-      tramp = &tramp_array[i];
-      tramp->table = table;
-      tramp->code = code;
-      tramp->parm = (struct tramp_parm *) parm;
-      tramp_add (tramp);
+  table->next = tramp_globals.tables;
+  __atomic_store_n (&tramp_globals.tables, table, __ATOMIC_RELEASE);
 
-      code += size;
-      parm += size;
-    }
-  /* Success */
-  return 1;
+  return tramp_table_revive (table);
 
 /* Failure */
 free_tramp_array:
@@ -528,94 +836,167 @@ free_table:
 }
 
 /*
- * Free a trampoline table.
+ * Unmap TABLE if all of its trampolines are free, some other table has free
+ * trampolines, and at least LIBFFI_TRAMP_KEEP other tables are completely
+ * free; we don't want to keep too many free trampoline tables lying around,
+ * nor to unmap and map a table on every free and allocation.
  */
 static void
-tramp_table_free (struct tramp_table *table)
+tramp_table_reclaim (struct tramp_table *table)
 {
-  tramp_table_unmap (table);
-  free (table->array);
-  free (table);
+  struct tramp_table *other, *spare = NULL;
+  int nfree = tramp_globals.ntramp, n;
+  unsigned int empty = 0;
+
+  ffi_tramp_lock();
+  for (other = tramp_globals.tables; other != NULL; other = other->next)
+    {
+      if (other == table)
+	continue;
+      n = __atomic_load_n (&other->nfree, __ATOMIC_RELAXED);
+      if (n > 0 && spare == NULL)
+	spare = other;
+      if (n == tramp_globals.ntramp)
+	empty++;
+    }
+
+  /*
+   * Fails if a trampoline was reserved meanwhile.
+   */
+  if (spare != NULL && empty >= tramp_globals.keep
+      && __atomic_compare_exchange_n (&table->nfree, &nfree, TRAMP_TABLE_DEAD,
+				      0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      __atomic_store_n (&tramp_globals.hint, spare, __ATOMIC_RELEASE);
+      tramp_table_unmap (table);
+      tramp_globals.nunmaps++;
+    }
+  ffi_tramp_unlock();
 }
 
+/* ------------------------- Trampoline functions ------------------------- */
+
 /*
- * Add a new trampoline table to the global table list.
+ * Reserve up to N free trampolines of TABLE. Return the number reserved.
  */
-static void
-tramp_table_add (struct tramp_table *table)
+static int
+tramp_reserve (struct tramp_table *table, int n)
 {
-  table->next = tramp_globals.free_tables;
-  table->prev = NULL;
-  if (tramp_globals.free_tables != NULL)
-    tramp_globals.free_tables->prev = table;
-  tramp_globals.free_tables = table;
-  tramp_globals.nfree_tables++;
+  int nfree, take;
+
+  nfree = __atomic_load_n (&table->nfree, __ATOMIC_RELAXED);
+  do
+    {
+      if (nfree <= 0)
+	return 0;
+      take = nfree < n ? nfree : n;
+    }
+  while (!__atomic_compare_exchange_n (&table->nfree, &nfree, nfree - take,
+				       1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+  return take;
 }
 
 /*
- * Delete a trampoline table from the global table list.
+ * Claim one free trampoline of TABLE after reserving it.
  */
-static void
-tramp_table_del (struct tramp_table *table)
+static struct tramp *
+tramp_claim (struct tramp_table *table)
 {
-  tramp_globals.nfree_tables--;
-  if (table->prev != NULL)
-    table->prev->next = table->next;
-  if (table->next != NULL)
-    table->next->prev = table->prev;
-  if (tramp_globals.free_tables == table)
-    tramp_globals.free_tables = table->next;
-}
+  unsigned long word, bit;
+  int i;
 
-/* ------------------------- Trampoline functions ------------------------- */
+  /*
+   * The reservation guarantees a set bit, although other threads may win
+   * the ones we see first.
+   */
+  for (;;)
+    for (i = 0; i < tramp_globals.nwords; i++)
+      {
+	word = __atomic_load_n (&table->free[i], __ATOMIC_RELAXED);
+	while (word != 0)
+	  {
+	    bit = word & -word;
+	    word = __atomic_fetch_and (&table->free[i], ~bit, __ATOMIC_ACQUIRE);
+	    if (word & bit)
+	      return &table->array[i * TRAMP_BITS + __builtin_ctzl (bit)];
+	    word &= ~bit;
+	  }
+      }
+}
 
 /*
- * Add a trampoline to its trampoline table.
+ * Take up to N free trampolines from the tables from FIRST up to, but not
+ * including, LAST. Return the number stored in TRAMPS.
  */
-static void
-tramp_add (struct tramp *tramp)
+static size_t
+tramp_take_from (struct tramp_table *first, struct tramp_table *last,
+		 void **tramps, size_t n)
 {
-  struct tramp_table *table = tramp->table;
+  struct tramp_table *table;
+  size_t got = 0;
+  int want, k;
+
+  for (table = first; table != last && table != NULL; table = table->next)
+    {
+      want = n - got > (size_t) tramp_globals.ntramp
+	? tramp_globals.ntramp : (int) (n - got);
+      k = tramp_reserve (table, want);
+      if (k == 0)
+	continue;
+
+      while (k-- > 0)
+	tramps[got++] = tramp_claim (table);
+      if (got == n)
+	{
+	  if (__atomic_load_n (&tramp_globals.hint, __ATOMIC_RELAXED) != table)
+	    __atomic_store_n (&tramp_globals.hint, table, __ATOMIC_RELEASE);
+	  break;
+	}
+    }
 
-  tramp->next = table->free;
-  tramp->prev = NULL;
-  if (table->free != NULL)
-    table->free->prev = tramp;
-  table->free = tramp;
-  table->nfree++;
+  return got;
+}
 
-  if (table->nfree == 1)
-    tramp_table_add (table);
+/*
+ * Take up to N free trampolines from the mapped tables without locking,
+ * starting with the hinted table. Return the number stored in TRAMPS.
+ */
+static size_t
+tramp_take (void **tramps, size_t n)
+{
+  struct tramp_table *start, *table;
+  size_t got = 0;
 
   /*
-   * We don't want to keep too many free trampoline tables lying around.
+   * The hint may be newer than the head we load after it, but every table
+   * is reachable from the hint or from the head.
    */
-  if (table->nfree == tramp_globals.ntramp &&
-    tramp_globals.nfree_tables > 1)
-    {
-      tramp_table_del (table);
-      tramp_table_free (table);
-    }
+  start = __atomic_load_n (&tramp_globals.hint, __ATOMIC_ACQUIRE);
+  table = __atomic_load_n (&tramp_globals.tables, __ATOMIC_ACQUIRE);
+  if (start == NULL)
+    start = table;
+
+  got = tramp_take_from (start, NULL, tramps, n);
+  if (got < n)
+    got += tramp_take_from (table, start, tramps + got, n - got);
+
+  return got;
 }
 
 /*
- * Remove a trampoline from its trampoline table.
+ * Return a trampoline to its trampoline table.
  */
 static void
-tramp_del (struct tramp *tramp)
+tramp_release (struct tramp *tramp)
 {
   struct tramp_table *table = tramp->table;
+  size_t i = tramp - table->array;
 
-  table->nfree--;
-  if (tramp->prev != NULL)
-    tramp->prev->next = tramp->next;
-  if (tramp->next != NULL)
-    tramp->next->prev = tramp->prev;
-  if (table->free == tramp)
-    table->free = tramp->next;
-
-  if (table->nfree == 0)
-    tramp_table_del (table);
+  __atomic_fetch_or (&table->free[i / TRAMP_BITS], 1UL << (i % TRAMP_BITS),
+		     __ATOMIC_RELEASE);
+  if (__atomic_add_fetch (&table->nfree, 1, __ATOMIC_RELEASE)
+      == tramp_globals.ntramp)
+    tramp_table_reclaim (table);
 }
 
 /* ------------------------ Trampoline API functions ------------------------ */
@@ -625,6 +1006,19 @@ ffi_tramp_is_supported(void)
 {
   int ret;
 
+  /*
+   * Initialization happens once; after that the verdict needs no lock.
+   */
+  switch (__atomic_load_n (&tramp_globals.status, __ATOMIC_ACQUIRE))
+    {
+    case TRAMP_GLOBALS_PASSED:
+      return 1;
+    case TRAMP_GLOBALS_FAILED:
+      return 0;
+    default:
+      break;
+    }
+
   ffi_tramp_lock();
   ret = ffi_tramp_init ();
   ffi_tramp_unlock();
@@ -637,28 +1031,44 @@ ffi_tramp_is_supported(void)
 void *
 ffi_tramp_alloc (int flags)
 {
-  struct tramp *tramp;
+  void *tramp;
 
-  ffi_tramp_lock();
+  if (flags != 0 || ffi_tramp_alloc_n (&tramp, 1) != 1)
+    return NULL;
 
-  if (!ffi_tramp_init () || flags != 0)
-    {
-      ffi_tramp_unlock();
-      return NULL;
-    }
+  return tramp;
+}
 
-  if (!tramp_table_alloc ())
+/*
+ * Allocate up to N trampolines, mapping as many new trampoline tables as
+ * that takes. Return the number of trampolines stored in TRAMPS.
+ */
+size_t
+ffi_tramp_alloc_n (void **tramps, size_t n)
+{
+  size_t got = 0;
+  int ok;
+
+  if (!ffi_tramp_is_supported ())
+    return 0;
+
+  for (;;)
     {
+      got += tramp_take (tramps + got, n - got);
+      if (got == n)
+	break;
+
+      /*
+       * Only mapping a new table takes the lock.
+       */
+      ffi_tramp_lock();
+      ok = tramp_table_alloc ();
       ffi_tramp_unlock();
-      return NULL;
+      if (!ok)
+	break;
     }
 
-  tramp = tramp_globals.free_tables->free;
-  tramp_del (tramp);
-
-  ffi_tramp_unlock();
-
-  return tramp;
+  return got;
 }
 
 /*
@@ -669,10 +1079,13 @@ ffi_tramp_set_parms (void *arg, void *target, void *data)
 {
   struct tramp *tramp = arg;
 
-  ffi_tramp_lock();
+  /*
+   * The trampoline belongs to the caller. The fence orders these stores
+   * before whatever publishes the trampoline to other threads.
+   */
   tramp->parm->target = target;
   tramp->parm->data = data;
-  ffi_tramp_unlock();
+  __atomic_thread_fence (__ATOMIC_RELEASE);
 }
 
 /*
@@ -682,13 +1095,12 @@ void *
 ffi_tramp_get_addr (void *arg)
 {
   struct tramp *tramp = arg;
-  void *addr;
 
-  ffi_tramp_lock();
-  addr = tramp->code;
-  ffi_tramp_unlock();
-
-  return addr;
+  /*
+   * The code address is fixed when the trampoline table is mapped, so no
+   * lock is needed to read it.
+   */
+  return tramp->code;
 }
 
 /*
@@ -697,11 +1109,56 @@ ffi_tramp_get_addr (void *arg)
 void
 ffi_tramp_free (void *arg)
 {
-  struct tramp *tramp = arg;
+  tramp_release (arg);
+}
+
+/*
+ * Free N trampolines.
+ */
+void
+ffi_tramp_free_n (void **tramps, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    tramp_release (tramps[i]);
+}
+
+/*
+ * Report the state of the trampoline tables. The counts are a snapshot:
+ * trampolines may be allocated and freed while they are gathered.
+ */
+int
+ffi_tramp_stats (struct ffi_tramp_stats *stats)
+{
+  struct tramp_table *table;
+  int nfree;
+
+  memset (stats, 0, sizeof (*stats));
+  if (!ffi_tramp_is_supported ())
+    return 0;
 
   ffi_tramp_lock();
-  tramp_add (tramp);
+  for (table = tramp_globals.tables; table != NULL; table = table->next)
+    {
+      nfree = __atomic_load_n (&table->nfree, __ATOMIC_RELAXED);
+      if (nfree == TRAMP_TABLE_DEAD)
+	continue;
+      stats->tables++;
+      stats->free_tramps += nfree;
+      if (nfree == tramp_globals.ntramp)
+	stats->empty_tables++;
+    }
+  stats->used_tramps = stats->tables * tramp_globals.ntramp
+    - stats->free_tramps;
+  stats->mapped_bytes = stats->tables * tramp_globals.map_size * 2;
+  stats->reserved_bytes = tramp_globals.nreserve * tramp_globals.map_size * 2;
+  stats->maps = tramp_globals.nmaps;
+  stats->unmaps = tramp_globals.nunmaps;
+  stats->keep_tables = tramp_globals.keep;
   ffi_tramp_unlock();
+
+  return 1;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -709,6 +1166,8 @@ ffi_tramp_free (void *arg)
 #else /* !FFI_EXEC_STATIC_TRAMP */
 
 #include <stddef.h>
+#include <string.h>
+#include <ffi.h>
 
 int
 ffi_tramp_is_supported(void)
@@ -722,6 +1181,12 @@ ffi_tramp_alloc (int flags)
   return NULL;
 }
 
+size_t
+ffi_tramp_alloc_n (void **tramps, size_t n)
+{
+  return 0;
+}
+
 void
 ffi_tramp_set_parms (void *arg, void *target, void *data)
 {
@@ -738,4 +1203,16 @@ ffi_tramp_free (void *arg)
 {
 }
 
+void
+ffi_tramp_free_n (void **tramps, size_t n)
+{
+}
+
+int
+ffi_tramp_stats (struct ffi_tramp_stats *stats)
+{
+  memset (stats, 0, sizeof (*stats));
+  return 0;
+}
+
 #endif /* FFI_EXEC_STATIC_TRAMP */
@@ -29,6 +29,7 @@
 #include <ffi_common.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 
 #include <emscripten/emscripten.h>
@@ -590,6 +591,40 @@ ffi_closure_free(void *closure) {
   return ffi_closure_free_js(closure);
 }
 
+int __attribute__ ((visibility ("default")))
+ffi_closure_alloc_n(size_t size, size_t n, void **closures, void **code) {
+  size_t i;
+  if (!closures || !code)
+    return 0;
+  for (i = 0; i < n; i++) {
+    closures[i] = ffi_closure_alloc(size, &code[i]);
+    if (closures[i] == NULL) {
+      ffi_closure_free_n(closures, i);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void __attribute__ ((visibility ("default")))
+ffi_closure_free_n(void **closures, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    ffi_closure_free(closures[i]);
+}
+
+int __attribute__ ((visibility ("default")))
+ffi_closure_heap_stats(struct ffi_closure_heap_stats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  return 0;
+}
+
+int __attribute__ ((visibility ("default")))
+ffi_closure_heap_trim(size_t pad) {
+  (void) pad;
+  return 0;
+}
+
 EM_JS_MACROS(
 ffi_status,
 ffi_prep_closure_loc_js,
@@ -427,6 +427,235 @@ ffi_call_go (ffi_cif *cif, void (*fn)(void), void *rvalue,
 }
 #endif
 
+/* Reusable call plans.  ffi_call_int works out, on every call, which
+   arguments go to registers under the cif's ABI and where each of the
+   rest lands in the outgoing frame.  A plan makes that walk once and
+   records one move per argument, in argument order, as a register number
+   or a byte offset from the bottom of the argument area, so
+   ffi_call_plan_invoke only stores values and enters ffi_call_i386.  */
+
+enum ffi_plan_op
+{
+  FFI_PLAN_REG,		/* extend_basic_type into frame->regs[POS]	*/
+  FFI_PLAN_EXT,		/* extend_basic_type into the stack at POS	*/
+  FFI_PLAN_COPY		/* memcpy LEN bytes to the stack at POS		*/
+};
+
+typedef struct
+{
+  unsigned char op;		/* enum ffi_plan_op			*/
+  unsigned char type;		/* FFI_TYPE_* for REG and EXT		*/
+  int pos;			/* register number or stack offset	*/
+  unsigned len;			/* bytes copied by COPY			*/
+} ffi_plan_move;
+
+struct ffi_call_plan
+{
+  ffi_cif *cif;
+  unsigned bytes;		/* STACK_ALIGN (cif->bytes)		*/
+  int static_chain;		/* register cleared for a plain call	*/
+  int ret_reg;			/* register for the struct pointer, or -1 */
+  int ret_pos;			/* else its stack offset, or -1		*/
+  unsigned nmoves;
+  size_t alloc_bytes;
+  ffi_plan_move moves[];
+};
+
+ffi_call_plan *
+ffi_call_plan_alloc (ffi_cif *cif)
+{
+  const struct abi_params *pabi = &abi_params[cif->abi];
+  int cabi = cif->abi, dir = pabi->dir, narg_reg, pos;
+  unsigned bytes = STACK_ALIGN (cif->bytes);
+  ffi_call_plan *plan;
+  size_t nbytes;
+  int i, n = cif->nargs;
+
+  nbytes = sizeof (ffi_call_plan) + sizeof (ffi_plan_move) * n;
+  plan = malloc (nbytes);
+  if (plan == NULL)
+    return NULL;
+
+  plan->cif = cif;
+  plan->bytes = bytes;
+  plan->static_chain = pabi->static_chain;
+  plan->ret_reg = plan->ret_pos = -1;
+  plan->nmoves = n;
+  plan->alloc_bytes = nbytes;
+
+  /* Mirrors the placement in ffi_call_int; keep the two in step.  */
+  pos = (dir < 0 ? (int) bytes : 0);
+  narg_reg = 0;
+  switch (cif->flags)
+    {
+    case X86_RET_STRUCTARG:
+      if (pabi->nregs > 0)
+	{
+	  plan->ret_reg = pabi->regs[0];
+	  narg_reg = 1;
+	  break;
+	}
+      /* fallthru */
+    case X86_RET_STRUCTPOP:
+      plan->ret_pos = pos;
+      pos += sizeof (void *);
+      break;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      ffi_type *ty = cif->arg_types[i];
+      ffi_plan_move *m = &plan->moves[i];
+      size_t z = ty->size;
+      int t = ty->type;
+
+      m->type = t;
+      m->len = z;
+
+      if (z <= FFI_SIZEOF_ARG && t != FFI_TYPE_STRUCT)
+	{
+	  if (t != FFI_TYPE_FLOAT && narg_reg < pabi->nregs)
+	    {
+	      m->op = FFI_PLAN_REG;
+	      m->pos = pabi->regs[narg_reg++];
+	      continue;
+	    }
+	  m->op = FFI_PLAN_EXT;
+	  if (dir < 0)
+	    m->pos = pos -= 4;
+	  else
+	    {
+	      m->pos = pos;
+	      pos += 4;
+	    }
+	}
+      else
+	{
+	  size_t za = FFI_ALIGN (z, FFI_SIZEOF_ARG);
+	  size_t align = FFI_SIZEOF_ARG;
+
+	  /* Issue 434, as in ffi_call_int.  */
+	  if ((cabi == FFI_THISCALL || cabi == FFI_FASTCALL)
+	      && (t == FFI_TYPE_SINT64
+		  || t == FFI_TYPE_UINT64
+		  || t == FFI_TYPE_STRUCT))
+	    narg_reg = 2;
+
+	  if (t == FFI_TYPE_STRUCT && ty->alignment >= 16)
+	    align = 16;
+
+	  m->op = FFI_PLAN_COPY;
+	  if (dir < 0)
+	    m->pos = pos -= za;
+	  else
+	    {
+	      /* Offsets are from a 16-byte aligned base; see invoke.  */
+	      pos = FFI_ALIGN (pos, align);
+	      m->pos = pos;
+	      pos += za;
+	    }
+	}
+    }
+
+  return plan;
+}
+
+ffi_call_plan *
+ffi_call_plan_alloc_flags (ffi_cif *cif, unsigned int flags)
+{
+  /* No FFI_CALL_PLAN_* option is implemented on this target.  */
+  (void) flags;
+  return ffi_call_plan_alloc (cif);
+}
+
+#if defined(_MSC_VER)
+#pragma runtime_checks("s", off)
+#endif
+/* As ffi_call_int, ffi_call_i386 takes over the alloca'd block as its own
+   stack, so this must be compiled without ASAN.  */
+FFI_ASAN_NO_SANITIZE
+void
+ffi_call_plan_invoke (ffi_call_plan *plan, void (*fn)(void), void *rvalue,
+		      void **avalue)
+{
+  ffi_cif *cif = plan->cif;
+  int flags = cif->flags;
+  size_t rsize = 0, bytes = plan->bytes;
+  struct call_frame *frame;
+  char *stack;
+  unsigned i;
+
+  if (rvalue == NULL)
+    {
+      switch (flags)
+	{
+	case X86_RET_FLOAT:
+	case X86_RET_DOUBLE:
+	case X86_RET_LDOUBLE:
+	case X86_RET_STRUCTPOP:
+	case X86_RET_STRUCTARG:
+	  rsize = cif->rtype->size;
+	  break;
+	default:
+	  flags = X86_RET_VOID;
+	  break;
+	}
+    }
+
+  /* The plan's struct offsets assume a 16-byte aligned argument area.  */
+  stack = alloca (bytes + sizeof (*frame) + rsize + 15);
+  stack = (char *) FFI_ALIGN (stack, 16);
+  frame = (struct call_frame *)(stack + bytes);
+  if (rsize)
+    rvalue = frame + 1;
+
+  frame->fn = fn;
+  frame->flags = flags;
+  frame->rvalue = rvalue;
+  frame->regs[plan->static_chain] = 0;
+
+  if (plan->ret_reg >= 0)
+    frame->regs[plan->ret_reg] = (unsigned) rvalue;
+  else if (plan->ret_pos >= 0)
+    *(void **)(stack + plan->ret_pos) = rvalue;
+
+  for (i = 0; i < plan->nmoves; i++)
+    {
+      const ffi_plan_move *m = &plan->moves[i];
+      void *valp = avalue[i];
+
+      switch (m->op)
+	{
+	case FFI_PLAN_REG:
+	  frame->regs[m->pos] = extend_basic_type (valp, m->type);
+	  break;
+	case FFI_PLAN_EXT:
+	  *(ffi_arg *)(stack + m->pos) = extend_basic_type (valp, m->type);
+	  break;
+	case FFI_PLAN_COPY:
+	  memcpy (stack + m->pos, valp, m->len);
+	  break;
+	}
+    }
+
+  ffi_call_i386 (frame, stack);
+}
+#if defined(_MSC_VER)
+#pragma runtime_checks("s", restore)
+#endif
+
+void
+ffi_call_plan_free (ffi_call_plan *plan)
+{
+  free (plan);
+}
+
+size_t
+ffi_call_plan_size (ffi_call_plan *plan)
+{
+  return plan != NULL ? plan->alloc_bytes : 0;
+}
+
 /** private members **/
 
 void FFI_HIDDEN ffi_closure_i386(void);
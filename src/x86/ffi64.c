@@ -38,6 +38,15 @@
 #include <tramp.h>
 #include "internal64.h"
 
+/* Generated call stubs for FFI_CALL_PLAN_JIT take their memory from
+   ffi_code_alloc, which hands out none where the closure allocator has
+   no place for generated code.  */
+#if defined(__x86_64__) && !defined(__ILP32__) && FFI_CLOSURES
+# define FFI_PLAN_JIT 1
+#else
+# define FFI_PLAN_JIT 0
+#endif
+
 #ifdef __x86_64__
 
 #define MAX_GPR_REGS 6
@@ -396,6 +405,37 @@ classify_argument (ffi_type *type, enum x86_64_reg_class classes[],
   abort();
 }
 
+/* The classification of a struct, packed into the word ffi_type_abi_cache
+   keeps for a canonical type: byte 0 is the word count plus one (zero
+   means not yet classified), bytes 1 and 2 the GPR and SSE counts, byte 3
+   is 1 for x87 classes, and bytes 4 to 7 the classes themselves.
+   Structs nest, so classifying one walks every member, every time; for
+   canonical types that walk happens once.  */
+
+#ifdef __GNUC__
+#define CLASS_CACHE_LOAD(p)	__atomic_load_n ((p), __ATOMIC_RELAXED)
+#define CLASS_CACHE_STORE(p, v)	__atomic_store_n ((p), (v), __ATOMIC_RELAXED)
+#else
+/* An aligned eightbyte is read and written whole on x86-64.  */
+#define CLASS_CACHE_LOAD(p)	(*(volatile UINT64 *) (p))
+#define CLASS_CACHE_STORE(p, v)	(*(volatile UINT64 *) (p) = (v))
+#endif
+
+static UINT64
+class_cache_pack (size_t n, const enum x86_64_reg_class classes[MAX_CLASSES],
+		  int ngpr, int nsse, int x87)
+{
+  UINT64 word = (UINT64) (n + 1);
+  size_t i;
+
+  word |= (UINT64) ngpr << 8;
+  word |= (UINT64) nsse << 16;
+  word |= (UINT64) (x87 != 0) << 24;
+  for (i = 0; i < n; i++)
+    word |= (UINT64) classes[i] << (32 + 8 * i);
+  return word;
+}
+
 /* Examine the argument and return set number of register required in each
    class.  Return zero iff parameter should be passed in memory, otherwise
    the number of registers.  */
@@ -404,13 +444,37 @@ static size_t
 examine_argument (ffi_type *type, enum x86_64_reg_class classes[MAX_CLASSES],
 		  _Bool in_return, int *pngpr, int *pnsse)
 {
+  UINT64 *cache = NULL, word;
   size_t n;
   unsigned int i;
   int ngpr, nsse;
 
+  if (type->type == FFI_TYPE_STRUCT)
+    {
+      cache = ffi_type_abi_cache (type);
+      if (cache != NULL && (word = CLASS_CACHE_LOAD (cache)) != 0)
+	{
+	  n = (size_t) (word & 0xff) - 1;
+	  for (i = 0; i < n; i++)
+	    classes[i] = (enum x86_64_reg_class) ((word >> (32 + 8 * i))
+						  & 0xff);
+	  if (n == 0)
+	    return 0;
+	  if ((word >> 24) & 0xff)
+	    return in_return != 0;
+	  *pngpr = (int) ((word >> 8) & 0xff);
+	  *pnsse = (int) ((word >> 16) & 0xff);
+	  return n;
+	}
+    }
+
   n = classify_argument (type, classes, 0);
   if (n == 0)
-    return 0;
+    {
+      if (cache != NULL)
+	CLASS_CACHE_STORE (cache, class_cache_pack (0, classes, 0, 0, 0));
+      return 0;
+    }
 
   ngpr = nsse = 0;
   for (i = 0; i < n; ++i)
@@ -431,11 +495,16 @@ examine_argument (ffi_type *type, enum x86_64_reg_class classes[MAX_CLASSES],
       case X86_64_X87_CLASS:
       case X86_64_X87UP_CLASS:
       case X86_64_COMPLEX_X87_CLASS:
+	if (cache != NULL)
+	  CLASS_CACHE_STORE (cache, class_cache_pack (n, classes, 0, 0, 1));
 	return in_return != 0;
       default:
 	abort ();
       }
 
+  if (cache != NULL)
+    CLASS_CACHE_STORE (cache, class_cache_pack (n, classes, ngpr, nsse, 0));
+
   *pngpr = ngpr;
   *pnsse = nsse;
 
@@ -788,15 +857,17 @@ ffi_call_int (ffi_cif *cif, void (*fn)(void), void *rvalue,
    A plan is built by ffi_call_plan_alloc and applied by ffi_call_plan_invoke;
    the caller owns it and reuses it across calls.
 
-   Scalar, pointer, int128, float and double arguments are handled; any struct,
-   complex, or x87 long double argument has no plan, so the caller's invoke
-   falls back to ffi_call. */
+   Every UNIX64 argument is encoded: each eightbyte of a scalar, struct or
+   complex value gets the INTEGER/SSE placement classify_argument computed
+   for it, and anything examine_argument sends to memory (large structs, x87
+   long double) becomes a single stack move.  Other ABIs have no plan, so the
+   caller's invoke falls back to ffi_call. */
 
 enum ffi_move_op
 {
   FFI_MOVE_SE8, FFI_MOVE_SE16, FFI_MOVE_SE32,  /* sign-extend N bytes -> gpr   */
   FFI_MOVE_GP64,                               /* copy a full 8-byte word -> gpr */
-  FFI_MOVE_GP,                                 /* zero gpr, copy len(<8) bytes  */
+  FFI_MOVE_GP,                                 /* zero slot, copy len(<8) bytes */
   FFI_MOVE_SSE64, FFI_MOVE_SSE32,              /* copy 8/4 bytes -> sse slot    */
   FFI_MOVE_STACK                               /* copy len bytes -> stack       */
 };
@@ -810,6 +881,26 @@ typedef struct
   unsigned char op;
 } ffi_move;
 
+/* Stack-argument copies for ffi_plan_stack_call, in the layout unix64.S
+   reads: BYTES of outgoing area, then N moves of LEN bytes from
+   avalue[SRC_IDX] to DST_OFF within that area.  */
+typedef struct
+{
+  unsigned src_idx;
+  unsigned dst_off;
+  unsigned len;
+} ffi_stack_move;
+
+typedef struct
+{
+  unsigned bytes;
+  unsigned n;
+  ffi_stack_move m[];
+} ffi_stack_moves;
+
+/* Return of the lean trampoline / direct thunks: callee's rax in .i, xmm0 in .d. */
+struct ffi_ret2 { UINT64 i; double d; };
+
 typedef struct
 {
   unsigned nmoves;
@@ -817,18 +908,51 @@ typedef struct
   unsigned bytes;       /* stack-arg area size (== cif->bytes)             */
   unsigned flags;       /* == cif->flags                                   */
   unsigned ret_in_mem;  /* nonzero -> reg_args->gpr[0] = rvalue            */
-  unsigned fast;        /* nonzero -> lean trampoline eligible             */
+  unsigned fast;        /* FFI_PLAN_* trampoline, or 0 -> ffi_call_unix64  */
   unsigned retcode;     /* UNIX64_RET_* (low byte of flags) for the store  */
   int      thunk_n;     /* >=0 -> ffi_gp_thunks[thunk_n], else -1          */
+  int      mix_n;       /* >=0 -> ffi_mix_thunks[mix_n], else -1           */
   unsigned alloc_bytes; /* malloc'd size, reported by ffi_call_plan_size   */
+  unsigned jit_bytes;   /* size of the JIT stub, 0 if none                 */
+  struct ffi_ret2 (*jit) (void **, void (*)(void), void *);
+			/* generated stub, or NULL                         */
+  void *jit_data;       /* writable address of the stub                    */
+  ffi_stack_moves *stack; /* FFI_PLAN_STACK copies, inside this block      */
   ffi_move moves[];
 } ffi_plan;
 
-/* Return of the lean trampoline / direct thunks: callee's rax in .i, xmm0 in .d. */
-struct ffi_ret2 { UINT64 i; double d; };
+/* Which lean trampoline a plan uses, by stack arguments and return.  */
+enum ffi_plan_kind
+{
+  FFI_PLAN_SLOW,	/* stack args, x87: alloca + ffi_call_unix64    */
+  FFI_PLAN_SIMPLE,	/* VOID..XMM64: ffi_plan_fast_call              */
+  FFI_PLAN_REGS,	/* ST_* pairs, XMM128: ffi_plan_fast_call_regs  */
+  FFI_PLAN_X87,		/* X87, X87_2: ffi_plan_fast_call_x87           */
+  FFI_PLAN_STACK	/* stack args: ffi_plan_stack_call              */
+};
+
 extern struct ffi_ret2 ffi_plan_fast_call (struct register_args *img,
 					   void (*fn) (void)) FFI_HIDDEN;
 
+/* Every register a two-eightbyte return can use, as ffi_plan_fast_call_regs
+   leaves them.  The offsets are fixed by unix64.S.  */
+struct ffi_ret_regs
+{
+  UINT64 rax, rdx;
+  union big_int_union xmm0;
+  UINT64 xmm1;
+};
+extern void ffi_plan_fast_call_regs (struct register_args *img,
+				     void (*fn) (void),
+				     struct ffi_ret_regs *out) FFI_HIDDEN;
+extern void ffi_plan_fast_call_x87 (struct register_args *img,
+				    void (*fn) (void), void *rvalue,
+				    unsigned long two) FFI_HIDDEN;
+extern void ffi_plan_stack_call (struct register_args *img,
+				 void (*fn) (void), void **avalue,
+				 const ffi_stack_moves *stack,
+				 struct ffi_ret_regs *out) FFI_HIDDEN;
+
 /* Count-based direct thunks: load avalue[0..N-1] into arg registers, call. */
 extern struct ffi_ret2 ffi_plan_gp0 (void **, void (*)(void)) FFI_HIDDEN;
 extern struct ffi_ret2 ffi_plan_gp1 (void **, void (*)(void)) FFI_HIDDEN;
@@ -841,6 +965,38 @@ static struct ffi_ret2 (*const ffi_gp_thunks[7]) (void **, void (*)(void)) =
   { ffi_plan_gp0, ffi_plan_gp1, ffi_plan_gp2, ffi_plan_gp3,
     ffi_plan_gp4, ffi_plan_gp5, ffi_plan_gp6 };
 
+/* Compact register file for the shape-keyed thunks: only the 8-byte halves
+   a non-SSEUP argument can use, in the layout unix64.S expects.  */
+struct ffi_plan_regs
+{
+  UINT64 gpr[MAX_GPR_REGS];
+  UINT64 sse[MAX_SSE_REGS];
+};
+
+/* Shape-keyed direct thunks: ffi_plan_mix_G_S loads G GPRs and S SSE
+   registers from a struct ffi_plan_regs and calls.  */
+#define FFI_MIX_DECL(G, S) \
+  extern struct ffi_ret2 ffi_plan_mix_##G##_##S (struct ffi_plan_regs *, \
+						 void (*)(void)) FFI_HIDDEN;
+#define FFI_MIX_DECLS(G) \
+  FFI_MIX_DECL(G, 0) FFI_MIX_DECL(G, 1) FFI_MIX_DECL(G, 2) \
+  FFI_MIX_DECL(G, 3) FFI_MIX_DECL(G, 4) FFI_MIX_DECL(G, 5) \
+  FFI_MIX_DECL(G, 6) FFI_MIX_DECL(G, 7) FFI_MIX_DECL(G, 8)
+#define FFI_MIX_ROW(G) \
+  ffi_plan_mix_##G##_0, ffi_plan_mix_##G##_1, ffi_plan_mix_##G##_2, \
+  ffi_plan_mix_##G##_3, ffi_plan_mix_##G##_4, ffi_plan_mix_##G##_5, \
+  ffi_plan_mix_##G##_6, ffi_plan_mix_##G##_7, ffi_plan_mix_##G##_8
+
+FFI_MIX_DECLS(0) FFI_MIX_DECLS(1) FFI_MIX_DECLS(2) FFI_MIX_DECLS(3)
+FFI_MIX_DECLS(4) FFI_MIX_DECLS(5) FFI_MIX_DECLS(6)
+
+/* Indexed by G * (MAX_SSE_REGS + 1) + S.  */
+static struct ffi_ret2 (*const ffi_mix_thunks[(MAX_GPR_REGS + 1)
+					      * (MAX_SSE_REGS + 1)])
+  (struct ffi_plan_regs *, void (*)(void)) =
+  { FFI_MIX_ROW(0), FFI_MIX_ROW(1), FFI_MIX_ROW(2), FFI_MIX_ROW(3),
+    FFI_MIX_ROW(4), FFI_MIX_ROW(5), FFI_MIX_ROW(6) };
+
 /* Store the callee return value, replicating the unix64.S store_table widths. */
 static inline void
 store_ret (void *rvalue, unsigned retcode, struct ffi_ret2 r)
@@ -860,38 +1016,236 @@ store_ret (void *rvalue, unsigned retcode, struct ffi_ret2 r)
     }
 }
 
-/* Build the move-list for CIF, or NULL if not plan-able (caller falls back). */
+/* Store a register-pair return, replicating the unix64.S L(s2)/L(s3) tails:
+   assemble the two eightbytes in order, then copy only the struct's size.  */
+static inline void
+store_ret_regs (void *rvalue, unsigned flags, struct ffi_ret_regs *r)
+{
+  UINT64 buf[2];
+
+  switch (flags & 0xff)
+    {
+    case UNIX64_RET_XMM128:
+      memcpy (rvalue, &r->xmm0, 16);
+      return;
+    case UNIX64_RET_ST_XMM0_RAX:
+      buf[0] = r->xmm0.i64;
+      buf[1] = r->rax;
+      break;
+    case UNIX64_RET_ST_RAX_XMM0:
+      buf[0] = r->rax;
+      buf[1] = r->xmm0.i64;
+      break;
+    case UNIX64_RET_ST_XMM0_XMM1:
+      buf[0] = r->xmm0.i64;
+      buf[1] = r->xmm1;
+      break;
+    default: /* UNIX64_RET_ST_RAX_RDX */
+      buf[0] = r->rax;
+      buf[1] = r->rdx;
+      break;
+    }
+  memcpy (rvalue, buf, flags >> UNIX64_SIZE_SHIFT);
+}
+
+#if FFI_PLAN_JIT
+/* FFI_CALL_PLAN_JIT: emit a stub for one signature.
+   struct ffi_ret2 stub (void **avalue /rdi/, void (*fn)(void) /rsi/,
+			 void *rvalue /rdx/);
+
+   The stub loads each register straight from avalue with the width and
+   extension the move list records, sets %al, and tail-jumps to FN, whose
+   rax/xmm0 then return to our caller exactly as from the direct thunks.
+   Because the stub has no frame and is gone from the stack during the call,
+   it needs no unwind information.  Only plans on the simple-return lean path
+   whose moves all have a single-instruction load are compiled; anything
+   else keeps the regular plan.  Stubs are packed into pages from
+   ffi_code_alloc, written once through a writable view and run from a
+   separate executable one.  */
+
+/* %rdi, %rsi, %rdx, %rcx, %r8, %r9 in encoding order.  */
+static const unsigned char jit_gpr[MAX_GPR_REGS] = { 7, 6, 2, 1, 8, 9 };
+
+/* Emit ModRM + disp32 for REG, disp(%r10).  */
+static unsigned char *
+jit_mem_r10 (unsigned char *p, unsigned reg, unsigned disp)
+{
+  *p++ = (unsigned char) (0x80 | ((reg & 7) << 3) | 2);
+  memcpy (p, &disp, 4);
+  return p + 4;
+}
+
+/* Emit the load for move M, with its source pointer already in %r10.
+   Returns NULL if M has no single-instruction load.  */
+static unsigned char *
+jit_emit_move (unsigned char *p, const ffi_move *m)
+{
+  const unsigned sse_off = offsetof (struct register_args, sse);
+
+  if (m->op == FFI_MOVE_STACK)
+    return NULL;
+
+  if (m->dst_off < sse_off)
+    {
+      unsigned reg = jit_gpr[m->dst_off / 8];
+      unsigned char rex = (unsigned char) (0x41 | (reg >= 8 ? 4 : 0));
+
+      switch (m->op)
+	{
+	case FFI_MOVE_SE8:  *p++ = rex | 8; *p++ = 0x0f; *p++ = 0xbe; break;
+	case FFI_MOVE_SE16: *p++ = rex | 8; *p++ = 0x0f; *p++ = 0xbf; break;
+	case FFI_MOVE_SE32: *p++ = rex | 8; *p++ = 0x63; break;
+	case FFI_MOVE_GP64: *p++ = rex | 8; *p++ = 0x8b; break;
+	case FFI_MOVE_GP:
+	  /* 32-bit loads zero the upper half, as the image path does.  */
+	  if (m->len == 1)
+	    { *p++ = rex; *p++ = 0x0f; *p++ = 0xb6; }
+	  else if (m->len == 2)
+	    { *p++ = rex; *p++ = 0x0f; *p++ = 0xb7; }
+	  else if (m->len == 4)
+	    { *p++ = rex; *p++ = 0x8b; }
+	  else
+	    return NULL;
+	  break;
+	default:
+	  return NULL;
+	}
+      return jit_mem_r10 (p, reg, m->src_off);
+    }
+  else
+    {
+      unsigned rel = m->dst_off - sse_off;
+      unsigned reg = rel / sizeof (union big_int_union);
+
+      if (rel % sizeof (union big_int_union) != 0)
+	{
+	  /* SSEUP: movhps fills the upper half, keeping the lower.  */
+	  if (m->op != FFI_MOVE_GP64)
+	    return NULL;
+	  *p++ = 0x41; *p++ = 0x0f; *p++ = 0x16;
+	}
+      else if (m->op == FFI_MOVE_SSE64)
+	{
+	  /* movq zeroes the upper half.  */
+	  *p++ = 0xf3; *p++ = 0x41; *p++ = 0x0f; *p++ = 0x7e;
+	}
+      else if (m->op == FFI_MOVE_SSE32
+	       || (m->op == FFI_MOVE_GP && m->len == 4))
+	{
+	  *p++ = 0x66; *p++ = 0x41; *p++ = 0x0f; *p++ = 0x6e;	/* movd */
+	}
+      else
+	return NULL;
+      return jit_mem_r10 (p, reg, m->src_off);
+    }
+}
+
+/* Compile PLAN into a stub, setting plan->jit on success.  */
+static void
+jit_compile (ffi_plan *plan)
+{
+  unsigned char *buf, *p;
+  unsigned k, cur = ~0u;
+  size_t size;
+  void *code;
+
+  if (plan->fast != FFI_PLAN_SIMPLE)
+    return;
+
+  /* 14 bytes of prologue and 11 of epilogue; at most 7 bytes to fetch a
+     source pointer and 9 for a load per move.  */
+  size = 32 + 16 * (size_t) plan->nmoves;
+  buf = ffi_code_alloc (size, &code);
+  if (buf == NULL)
+    return;
+
+  p = buf;
+  *p++ = 0xf3; *p++ = 0x0f; *p++ = 0x1e; *p++ = 0xfa;	/* endbr64 */
+  *p++ = 0x49; *p++ = 0x89; *p++ = 0xf3;		/* mov %rsi,%r11 */
+  *p++ = 0x48; *p++ = 0x89; *p++ = 0xf8;		/* mov %rdi,%rax */
+  if (plan->ret_in_mem)
+    { *p++ = 0x48; *p++ = 0x89; *p++ = 0xd7; }		/* mov %rdx,%rdi */
+
+  for (k = 0; k < plan->nmoves; k++)
+    {
+      const ffi_move *m = &plan->moves[k];
+      if (m->src_idx != cur)
+	{
+	  unsigned disp = m->src_idx * (unsigned) sizeof (void *);
+	  *p++ = 0x4c; *p++ = 0x8b; *p++ = 0x90;	/* mov disp(%rax),%r10 */
+	  memcpy (p, &disp, 4);
+	  p += 4;
+	  cur = m->src_idx;
+	}
+      p = jit_emit_move (p, m);
+      if (p == NULL)
+	{
+	  ffi_code_free (buf, size);
+	  return;
+	}
+    }
+
+  *p++ = 0xb8;					/* mov $ssecount,%eax */
+  memcpy (p, &plan->ssecount, 4);
+  p += 4;
+  *p++ = 0x41; *p++ = 0xff; *p++ = 0xe3;		/* jmp *%r11 */
+
+  plan->jit = (struct ffi_ret2 (*) (void **, void (*)(void), void *)) code;
+  plan->jit_data = buf;
+  plan->jit_bytes = (unsigned) size;
+}
+#endif /* FFI_PLAN_JIT */
+
+/* Release a plan built by build_plan.  */
+static void
+plan_free (ffi_plan *plan)
+{
+  if (plan == NULL)
+    return;
+#if FFI_PLAN_JIT
+  if (plan->jit != NULL)
+    ffi_code_free (plan->jit_data, plan->jit_bytes);
+#endif
+  free (plan);
+}
+
+/* Build the move-list for CIF, or NULL if not plan-able (caller falls back).
+   FLAGS are the FFI_CALL_PLAN_* options given to ffi_call_plan_alloc_flags. */
 static ffi_plan *
-build_plan (ffi_cif *cif)
+build_plan (ffi_cif *cif, unsigned flags)
 {
   unsigned i, avn = cif->nargs;
   enum x86_64_reg_class classes[MAX_CLASSES];
-  unsigned nm, gprcount, ssecount;
+  unsigned nm, nmax, gprcount, ssecount;
   size_t argp_off, nbytes;
   ffi_plan *plan;
   int all_gp64 = 1;	/* every arg is exactly one 64-bit GP move? */
+  int has_sseup = 0;	/* any move into the upper half of an %xmm? */
 
   if (cif->abi != FFI_UNIX64)
     return NULL;
 
-  /* Reject arg types this cut doesn't encode; returns are handled by flags. */
-  for (i = 0; i < avn; i++)
+  /* Bound the move count: an argument takes one move per eightbyte when it
+     is in registers (at most MAX_CLASSES), or a single stack move.  */
+  for (i = 0, nm = 1; i < avn; i++)
     {
-      int t = cif->arg_types[i]->type;
-      if (t == FFI_TYPE_STRUCT || t == FFI_TYPE_COMPLEX)
-	return NULL;
-#if FFI_TYPE_LONGDOUBLE != FFI_TYPE_DOUBLE
-      if (t == FFI_TYPE_LONGDOUBLE)
-	return NULL;
-#endif
+      size_t words = (cif->arg_types[i]->size + 7) / 8;
+      nm += words == 0 ? 1 : words > MAX_CLASSES ? MAX_CLASSES : words;
     }
 
-  /* One self-contained allocation: header + moves, released with plain free(). */
-  nbytes = sizeof (ffi_plan) + sizeof (ffi_move) * (2 * avn + 1);
+  /* One self-contained allocation: header + moves + stack copies (at most
+     one per argument), released with plain free(). */
+  nmax = nm;
+  nbytes = sizeof (ffi_plan) + sizeof (ffi_move) * nmax
+	   + sizeof (ffi_stack_moves) + sizeof (ffi_stack_move) * avn;
   plan = malloc (nbytes);
   if (plan == NULL)
     return NULL;
   plan->alloc_bytes = (unsigned) nbytes;
+  plan->jit = NULL;
+  plan->jit_data = NULL;
+  plan->jit_bytes = 0;
+  plan->stack = NULL;
 
   nm = gprcount = ssecount = 0;
   argp_off = 0;
@@ -934,8 +1288,20 @@ build_plan (ffi_cif *cif)
 	  switch (classes[j])
 	    {
 	    case X86_64_NO_CLASS:
-	    case X86_64_SSEUP_CLASS:
 	      continue;			/* nothing placed for this 8-byte */
+	    case X86_64_SSEUP_CLASS:
+	      /* Upper half of the %xmm register the preceding SSE eightbyte
+		 went to (16-byte vectors, binary128 long double).  */
+	      m.dst_off = (unsigned) (offsetof (struct register_args, sse)
+				      + (ssecount - 1) * sizeof (union big_int_union)
+				      + 8);
+	      if (rem >= 8)
+		m.op = FFI_MOVE_GP64;
+	      else
+		{ m.op = FFI_MOVE_GP; m.len = (unsigned) rem; }
+	      all_gp64 = 0;
+	      has_sseup = 1;
+	      break;
 	    case X86_64_INTEGER_CLASS:
 	    case X86_64_INTEGERSI_CLASS:
 	      m.dst_off = gprcount * 8;	/* offsetof(register_args,gpr) == 0 */
@@ -957,7 +1323,12 @@ build_plan (ffi_cif *cif)
 	    case X86_64_SSEDF_CLASS:
 	      m.dst_off = (unsigned) (offsetof (struct register_args, sse)
 				      + ssecount * sizeof (union big_int_union));
-	      m.op = FFI_MOVE_SSE64;
+	      /* A struct's trailing SSE eightbyte may be short, e.g. the
+		 {float,char} tail of a 12-byte struct; don't read past it.  */
+	      if (rem >= 8)
+		m.op = FFI_MOVE_SSE64;
+	      else
+		{ m.op = FFI_MOVE_GP; m.len = (unsigned) rem; }
 	      ssecount++;
 	      all_gp64 = 0;
 	      break;
@@ -981,20 +1352,109 @@ build_plan (ffi_cif *cif)
   plan->bytes = cif->bytes;
   plan->flags = cif->flags;
   plan->retcode = cif->flags & 0xff;	/* UNIX64_RET_* */
-  /* Lean-trampoline eligible: no spilled stack args and a simple return
-     (VOID..XMM64, codes 0..9; RET_IN_MEM has low byte VOID).  Struct-in-regs
-     (>=12) and x87 (10,11) returns stay on ffi_call_unix64. */
-  plan->fast = (cif->bytes == 0 && plan->retcode <= UNIX64_RET_XMM64) ? 1 : 0;
+  /* Lean-trampoline eligible: no spilled stack args.  The return code picks
+     the trampoline (RET_IN_MEM has low byte VOID, so it is SIMPLE).  With
+     stack args, anything but an x87 return uses ffi_plan_stack_call: its
+     stack moves come out of the move list into the table it copies from.  */
+  if (cif->bytes != 0)
+    {
+      if (plan->retcode == UNIX64_RET_X87
+	  || plan->retcode == UNIX64_RET_X87_2)
+	plan->fast = FFI_PLAN_SLOW;
+      else
+	{
+	  const unsigned base = sizeof (struct register_args);
+	  ffi_stack_moves *st = (ffi_stack_moves *) &plan->moves[nmax];
+	  unsigned k;
+
+	  st->bytes = cif->bytes;
+	  st->n = 0;
+	  for (i = k = 0; i < nm; i++)
+	    {
+	      ffi_move *m = &plan->moves[i];
+	      if (m->op == FFI_MOVE_STACK)
+		{
+		  ffi_stack_move *sm = &st->m[st->n++];
+		  sm->src_idx = m->src_idx;
+		  sm->dst_off = m->dst_off - base;
+		  sm->len = m->len;
+		}
+	      else
+		plan->moves[k++] = *m;
+	    }
+	  plan->nmoves = nm = k;
+	  plan->stack = st;
+	  plan->fast = FFI_PLAN_STACK;
+	}
+    }
+  else if (plan->retcode <= UNIX64_RET_XMM64)
+    plan->fast = FFI_PLAN_SIMPLE;
+  else if (plan->retcode == UNIX64_RET_X87
+	   || plan->retcode == UNIX64_RET_X87_2)
+    plan->fast = FFI_PLAN_X87;
+  else
+    plan->fast = FFI_PLAN_REGS;
   /* Pure-GP64 direct thunk: every arg is one 64-bit GP value (so a plain load
      per arg is exact), <=6 of them, no sret, simple return -> load avalue
      straight into the arg registers, no register image. */
   plan->thunk_n =
     (all_gp64 && !plan->ret_in_mem && nm == avn && avn <= MAX_GPR_REGS
-     && plan->fast)
+     && plan->fast == FFI_PLAN_SIMPLE)
     ? (int) avn : -1;
+  /* Mixed GP/SSE direct thunk: anything else on the simple-return lean path
+     whose SSE values fit in 8 bytes, so the compact register file holds it.
+     The thunk sets %al to the exact SSE count, which variadic callees need.
+     Retarget the SSE moves from 16-byte image slots to 8-byte compact
+     slots.  */
+  plan->mix_n = -1;
+#if FFI_PLAN_JIT
+  if (flags & FFI_CALL_PLAN_JIT)
+    jit_compile (plan);
+#else
+  (void) flags;
+#endif
+  if (plan->jit == NULL && plan->thunk_n < 0
+      && plan->fast == FFI_PLAN_SIMPLE && !has_sseup)
+    {
+      const unsigned sse_off = offsetof (struct register_args, sse);
+      for (i = 0; i < nm; i++)
+	if (plan->moves[i].dst_off >= sse_off)
+	  plan->moves[i].dst_off =
+	    (unsigned) (offsetof (struct ffi_plan_regs, sse)
+			+ (plan->moves[i].dst_off - sse_off)
+			  / sizeof (union big_int_union) * 8);
+      plan->mix_n = (int) (gprcount * (MAX_SSE_REGS + 1) + ssecount);
+    }
   return plan;
 }
 
+/* Apply PLAN's move list, copying each argument piece from AVALUE to its
+   offset from BASE (a register_args image or a struct ffi_plan_regs).  */
+static inline __attribute__ ((always_inline)) void
+plan_moves (ffi_plan *plan, char *base, void **avalue)
+{
+  unsigned k;
+
+  for (k = 0; k < plan->nmoves; k++)
+    {
+      ffi_move *m = &plan->moves[k];
+      char *src = (char *) avalue[m->src_idx] + m->src_off;
+      char *dst = base + m->dst_off;
+      switch (m->op)
+	{
+	/* x86-64: unaligned scalar loads from avalue[] are fine. */
+	case FFI_MOVE_SE8:   *(UINT64 *) dst = (UINT64) (SINT64) *(SINT8 *)  src; break;
+	case FFI_MOVE_SE16:  *(UINT64 *) dst = (UINT64) (SINT64) *(SINT16 *) src; break;
+	case FFI_MOVE_SE32:  *(UINT64 *) dst = (UINT64) (SINT64) *(SINT32 *) src; break;
+	case FFI_MOVE_GP64:  *(UINT64 *) dst = *(UINT64 *) src;                   break;
+	case FFI_MOVE_GP:    *(UINT64 *) dst = 0; memcpy (dst, src, m->len);     break;
+	case FFI_MOVE_SSE64: *(UINT64 *) dst = *(UINT64 *) src;                   break;
+	case FFI_MOVE_SSE32: *(UINT32 *) dst = *(UINT32 *) src;                   break;
+	case FFI_MOVE_STACK: memcpy (dst, src, m->len);                          break;
+	}
+    }
+}
+
 /* Execute PLAN: rebuild register_args + stack buffer, then ffi_call_unix64. */
 FFI_ASAN_NO_SANITIZE
 static inline __attribute__ ((always_inline)) void
@@ -1005,7 +1465,6 @@ plan_exec (ffi_cif *cif, ffi_plan *plan, void (*fn) (void),
   struct register_args local __attribute__ ((aligned (16)));
   char *stack = NULL;
   struct register_args *reg_args;
-  unsigned k;
 
   if (rvalue == NULL)
     {
@@ -1015,6 +1474,15 @@ plan_exec (ffi_cif *cif, ffi_plan *plan, void (*fn) (void),
 	flags = UNIX64_RET_VOID;
     }
 
+  if (plan->jit != NULL)
+    {
+      /* Generated stub: one straight-line load per move, then FN.  */
+      struct ffi_ret2 r = plan->jit (avalue, fn, rvalue);
+      if (rvalue != NULL)
+	store_ret (rvalue, plan->retcode, r);
+      return;
+    }
+
   if (plan->thunk_n >= 0)
     {
       /* Pure-GP64: load avalue straight into arg regs, no image at all. */
@@ -1024,8 +1492,24 @@ plan_exec (ffi_cif *cif, ffi_plan *plan, void (*fn) (void),
       return;
     }
 
-  if (plan->fast)
-    reg_args = &local;			/* no stack args: fixed local image */
+  if (plan->mix_n >= 0)
+    {
+      /* Mixed GP/SSE: fill only the words the shape uses, then load exactly
+	 those registers.  */
+      struct ffi_plan_regs regs;
+      struct ffi_ret2 r;
+
+      if (plan->ret_in_mem)
+	regs.gpr[0] = (UINT64) (uintptr_t) rvalue;
+      plan_moves (plan, (char *) &regs, avalue);
+      r = ffi_mix_thunks[plan->mix_n] (&regs, fn);
+      if (rvalue != NULL)
+	store_ret (rvalue, plan->retcode, r);
+      return;
+    }
+
+  if (plan->fast != FFI_PLAN_SLOW)
+    reg_args = &local;			/* stack args, if any, copied by asm */
   else
     {
       stack = alloca (sizeof (struct register_args) + plan->bytes + 4 * 8);
@@ -1035,34 +1519,56 @@ plan_exec (ffi_cif *cif, ffi_plan *plan, void (*fn) (void),
   if (plan->ret_in_mem)
     reg_args->gpr[0] = (UINT64) (uintptr_t) rvalue;
 
-  for (k = 0; k < plan->nmoves; k++)
-    {
-      ffi_move *m = &plan->moves[k];
-      char *src = (char *) avalue[m->src_idx] + m->src_off;
-      char *dst = (char *) reg_args + m->dst_off;
-      switch (m->op)
-	{
-	/* x86-64: unaligned scalar loads from avalue[] are fine. */
-	case FFI_MOVE_SE8:   *(UINT64 *) dst = (UINT64) (SINT64) *(SINT8 *)  src; break;
-	case FFI_MOVE_SE16:  *(UINT64 *) dst = (UINT64) (SINT64) *(SINT16 *) src; break;
-	case FFI_MOVE_SE32:  *(UINT64 *) dst = (UINT64) (SINT64) *(SINT32 *) src; break;
-	case FFI_MOVE_GP64:  *(UINT64 *) dst = *(UINT64 *) src;                   break;
-	case FFI_MOVE_GP:    *(UINT64 *) dst = 0; memcpy (dst, src, m->len);     break;
-	case FFI_MOVE_SSE64: *(UINT64 *) dst = *(UINT64 *) src;                   break;
-	case FFI_MOVE_SSE32: *(UINT32 *) dst = *(UINT32 *) src;                   break;
-	case FFI_MOVE_STACK: memcpy (dst, src, m->len);                          break;
-	}
-    }
+  plan_moves (plan, (char *) reg_args, avalue);
   reg_args->rax = plan->ssecount;
 
-  if (plan->fast)
+  switch (plan->fast)
     {
-      /* No stack args; lean trampoline + return store replicating the
-	 unix64.S store_table widths.  ret_in_mem already wrote gpr[0]. */
-      struct ffi_ret2 r = ffi_plan_fast_call (reg_args, fn);
-      if (rvalue != NULL)
-	store_ret (rvalue, plan->retcode, r);
-      return;
+    case FFI_PLAN_SIMPLE:
+      {
+	/* No stack args; lean trampoline + return store replicating the
+	   unix64.S store_table widths.  ret_in_mem already wrote gpr[0]. */
+	struct ffi_ret2 r = ffi_plan_fast_call (reg_args, fn);
+	if (rvalue != NULL)
+	  store_ret (rvalue, plan->retcode, r);
+	return;
+      }
+    case FFI_PLAN_REGS:
+      {
+	struct ffi_ret_regs r;
+	ffi_plan_fast_call_regs (reg_args, fn, &r);
+	if (rvalue != NULL)
+	  store_ret_regs (rvalue, flags, &r);
+	return;
+      }
+    case FFI_PLAN_X87:
+      {
+	/* The x87 stack must be popped even when the result is discarded.  */
+	long double scratch[2];
+	ffi_plan_fast_call_x87 (reg_args, fn,
+				rvalue != NULL ? rvalue : (void *) scratch,
+				plan->retcode == UNIX64_RET_X87_2);
+	return;
+      }
+    case FFI_PLAN_STACK:
+      {
+	/* Stack args copied straight from avalue into the outgoing area;
+	   every return register comes back through R.  */
+	struct ffi_ret_regs r;
+	ffi_plan_stack_call (reg_args, fn, avalue, plan->stack, &r);
+	if (rvalue == NULL)
+	  return;
+	if (plan->retcode <= UNIX64_RET_XMM64)
+	  {
+	    struct ffi_ret2 r2;
+	    r2.i = r.rax;
+	    memcpy (&r2.d, &r.xmm0, sizeof (double));
+	    store_ret (rvalue, plan->retcode, r2);
+	  }
+	else
+	  store_ret_regs (rvalue, flags, &r);
+	return;
+      }
     }
 
   ffi_call_unix64 (stack, plan->bytes + sizeof (struct register_args),
@@ -1078,25 +1584,56 @@ struct ffi_call_plan
 {
   ffi_cif  *cif;
   ffi_plan *fast;		/* prebuilt plan, or NULL -> fall back to ffi_call */
+  struct win64_plan *win64;	/* FFI_EFI64/FFI_GNUW64 plan (ffiw64.c), or NULL */
 };
 
+struct win64_plan;
+extern struct win64_plan *
+ffi_win64_plan_alloc_efi64 (ffi_cif *cif) FFI_HIDDEN;
+extern size_t
+ffi_win64_plan_size_efi64 (struct win64_plan *plan) FFI_HIDDEN;
+extern void
+ffi_win64_plan_invoke_efi64 (struct win64_plan *plan, void (*fn) (void),
+			     void *rvalue, void **avalue) FFI_HIDDEN;
+
 ffi_call_plan *
-ffi_call_plan_alloc (ffi_cif *cif)
+ffi_call_plan_alloc_flags (ffi_cif *cif, unsigned int flags)
 {
   ffi_call_plan *plan = malloc (sizeof (struct ffi_call_plan));
   if (plan == NULL)
     return NULL;
   plan->cif  = cif;
-  plan->fast = build_plan (cif);	/* NULL if this signature has no fast path */
+  plan->fast = NULL;
+  plan->win64 = NULL;
+  if (cif->abi == FFI_EFI64 || cif->abi == FFI_GNUW64)
+    {
+      /* Win64 slots are fixed; FFI_CALL_PLAN_* options do not apply.  */
+      plan->win64 = ffi_win64_plan_alloc_efi64 (cif);
+      if (plan->win64 == NULL)
+	{
+	  free (plan);
+	  return NULL;
+	}
+    }
+  else
+    plan->fast = build_plan (cif, flags); /* NULL if this signature has no fast path */
   return plan;
 }
 
+ffi_call_plan *
+ffi_call_plan_alloc (ffi_cif *cif)
+{
+  return ffi_call_plan_alloc_flags (cif, 0);
+}
+
 void
 ffi_call_plan_invoke (ffi_call_plan *plan, void (*fn) (void),
 		      void *rvalue, void **avalue)
 {
   if (plan->fast != NULL)
     plan_exec (plan->cif, plan->fast, fn, rvalue, avalue);
+  else if (plan->win64 != NULL)
+    ffi_win64_plan_invoke_efi64 (plan->win64, fn, rvalue, avalue);
   else
     ffi_call (plan->cif, fn, rvalue, avalue);
 }
@@ -1106,7 +1643,8 @@ ffi_call_plan_free (ffi_call_plan *plan)
 {
   if (plan != NULL)
     {
-      free (plan->fast);
+      plan_free (plan->fast);
+      free (plan->win64);
       free (plan);
     }
 }
@@ -1116,10 +1654,12 @@ ffi_call_plan_size (ffi_call_plan *plan)
 {
   if (plan == NULL)
     return 0;
-  /* The move-list carries its own size; a signature with no fast path owns
-     nothing beyond the handle.  */
+  /* The move-list carries its own size, plus any JIT stub; a signature
+     with no fast path owns nothing beyond the handle.  */
   return sizeof (struct ffi_call_plan)
-	 + (plan->fast != NULL ? plan->fast->alloc_bytes : 0);
+	 + (plan->fast != NULL
+	    ? plan->fast->alloc_bytes + plan->fast->jit_bytes : 0)
+	 + (plan->win64 != NULL ? ffi_win64_plan_size_efi64 (plan->win64) : 0);
 }
 
 extern void
@@ -1205,12 +1745,19 @@ ffi_prep_closure_loc_efi64(ffi_closure* closure,
 			   void *codeloc);
 #endif
 
-ffi_status
-ffi_prep_closure_loc (ffi_closure* closure,
-		      ffi_cif* cif,
-		      void (*fun)(ffi_cif*, void*, void**, void*),
-		      void *user_data,
-		      void *codeloc)
+/* Entry points of a static trampoline, which arrive with the closure on
+   the stack rather than in %r10.  */
+#if defined(FFI_EXEC_STATIC_TRAMP)
+# define UNIX64_ALT(entry)	entry##_alt
+#else
+# define UNIX64_ALT(entry)	NULL
+#endif
+
+/* Make CLOSURE's trampoline enter DEST, or ALT when it uses a static
+   trampoline.  */
+static void
+unix64_set_tramp (ffi_closure *closure, void (*dest)(void),
+		  void (*alt)(void))
 {
   static const unsigned char trampoline[24] = {
     /* endbr64 */
@@ -1222,41 +1769,45 @@ ffi_prep_closure_loc (ffi_closure* closure,
     /* nopl  0(%rax) */
     0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00
   };
-  void (*dest)(void);
   char *tramp = closure->tramp;
 
-#ifndef __ILP32__
-  if (cif->abi == FFI_EFI64 || cif->abi == FFI_GNUW64)
-    return ffi_prep_closure_loc_efi64(closure, cif, fun, user_data, codeloc);
-#endif
-  if (cif->abi != FFI_UNIX64)
-    return FFI_BAD_ABI;
-
-  if (cif->flags & UNIX64_FLAG_XMM_ARGS)
-    dest = ffi_closure_unix64_sse;
-  else
-    dest = ffi_closure_unix64;
-
 #if defined(FFI_EXEC_STATIC_TRAMP)
   if (ffi_tramp_is_present(closure))
     {
       /* Initialize the static trampoline's parameters. */
-      if (dest == ffi_closure_unix64_sse)
-        dest = ffi_closure_unix64_sse_alt;
-      else
-        dest = ffi_closure_unix64_alt;
-      ffi_tramp_set_parms (closure->ftramp, dest, closure);
-      goto out;
+      ffi_tramp_set_parms (closure->ftramp, alt, closure);
+      return;
     }
+#else
+  (void) alt;
 #endif
 
   /* Initialize the dynamic trampoline. */
   memcpy (tramp, trampoline, sizeof(trampoline));
   *(UINT64 *)(tramp + sizeof (trampoline)) = (uintptr_t)dest;
+}
 
-#if defined(FFI_EXEC_STATIC_TRAMP)
-out:
+ffi_status
+ffi_prep_closure_loc (ffi_closure* closure,
+		      ffi_cif* cif,
+		      void (*fun)(ffi_cif*, void*, void**, void*),
+		      void *user_data,
+		      void *codeloc)
+{
+#ifndef __ILP32__
+  if (cif->abi == FFI_EFI64 || cif->abi == FFI_GNUW64)
+    return ffi_prep_closure_loc_efi64(closure, cif, fun, user_data, codeloc);
 #endif
+  if (cif->abi != FFI_UNIX64)
+    return FFI_BAD_ABI;
+
+  if (cif->flags & UNIX64_FLAG_XMM_ARGS)
+    unix64_set_tramp (closure, ffi_closure_unix64_sse,
+		      UNIX64_ALT (ffi_closure_unix64_sse));
+  else
+    unix64_set_tramp (closure, ffi_closure_unix64,
+		      UNIX64_ALT (ffi_closure_unix64));
+
   closure->cif = cif;
   closure->fun = fun;
   closure->user_data = user_data;
@@ -1363,6 +1914,286 @@ ffi_closure_unix64_inner(ffi_cif *cif,
   return flags;
 }
 
+#ifndef __ILP32__
+
+/* Closure plans.  ffi_closure_unix64_inner classifies every argument on
+   every call.  A closure plan does that once: each argument becomes a
+   pointer into the saved register_args or the caller's stack arguments,
+   or a list of eightbytes to gather into scratch when its registers are
+   not consecutive.  ffi_closure_unix64_plan[_sse] find the plan where the
+   other entry points find the cif, so ffi_closure_unix64_plan_inner only
+   walks the table.  */
+
+enum ffi_cplan_base
+{
+  FFI_CPLAN_REGS,		/* OFF into register_args		*/
+  FFI_CPLAN_STACK,		/* OFF from the first stack argument	*/
+  FFI_CPLAN_GATHER		/* N eightbytes from SRC to scratch+OFF	*/
+};
+
+typedef struct
+{
+  unsigned char base;		/* enum ffi_cplan_base			*/
+  unsigned char n;
+  unsigned short src[MAX_CLASSES];
+  unsigned off;
+} ffi_cplan_arg;
+
+struct ffi_closure_plan
+{
+  ffi_cif cif;			/* first: closure->cif points here	*/
+  ffi_cif *orig;		/* the cif handed to the handler	*/
+  unsigned scratch;		/* bytes of GATHER scratch per call	*/
+  int direct;			/* 0: not FFI_UNIX64, no table		*/
+  ffi_direct_loc *loc;		/* in-place offsets for direct closures	*/
+  ffi_cplan_arg args[];
+};
+
+#define CPLAN_GPR(n)	(offsetof (struct register_args, gpr) + (n) * 8)
+#define CPLAN_SSE(n)	(offsetof (struct register_args, sse) \
+			 + (n) * sizeof (union big_int_union))
+
+extern void ffi_closure_unix64_plan(void) FFI_HIDDEN;
+extern void ffi_closure_unix64_plan_sse(void) FFI_HIDDEN;
+#if defined(FFI_EXEC_STATIC_TRAMP)
+extern void ffi_closure_unix64_plan_alt(void) FFI_HIDDEN;
+extern void ffi_closure_unix64_plan_sse_alt(void) FFI_HIDDEN;
+#endif
+
+ffi_closure_plan *
+ffi_closure_plan_alloc (ffi_cif *cif)
+{
+  ffi_closure_plan *plan;
+  unsigned i, avn = cif->nargs;
+  int gprcount = 0, ssecount = 0, ngpr, nsse;
+  size_t argp = 0, scratch = 0;
+
+  plan = malloc (sizeof (ffi_closure_plan)
+		 + (sizeof (ffi_cplan_arg) + sizeof (ffi_direct_loc)) * avn);
+  if (plan == NULL)
+    return NULL;
+  plan->cif = *cif;
+  plan->orig = cif;
+  plan->scratch = 0;
+  plan->direct = (cif->abi == FFI_UNIX64);
+  plan->loc = (ffi_direct_loc *) &plan->args[avn];
+  if (!plan->direct)
+    return plan;
+
+  /* Mirrors ffi_closure_unix64_inner; keep the two in step.  The stack
+     arguments start 16-byte aligned, so offsets from 0 align the same.  */
+  if (cif->flags & UNIX64_FLAG_RET_IN_MEM)
+    gprcount++;
+
+  for (i = 0; i < avn; i++)
+    {
+      ffi_type *ty = cif->arg_types[i];
+      ffi_cplan_arg *a = &plan->args[i];
+      enum x86_64_reg_class classes[MAX_CLASSES];
+      size_t n;
+
+      n = examine_argument (ty, classes, 0, &ngpr, &nsse);
+      if (n == 0
+	  || gprcount + ngpr > MAX_GPR_REGS
+	  || ssecount + nsse > MAX_SSE_REGS)
+	{
+	  size_t align = ty->alignment < 8 ? 8 : ty->alignment;
+
+	  argp = FFI_ALIGN (argp, align);
+	  a->base = FFI_CPLAN_STACK;
+	  a->off = argp;
+	  argp += ty->size;
+	  plan->loc[i].lo = UNIX64_CLOSURE_ARGP + a->off;
+	}
+      else if (n == 1
+	       || (n == 2 && !(SSE_CLASS_P (classes[0])
+			       || SSE_CLASS_P (classes[1]))))
+	{
+	  a->base = FFI_CPLAN_REGS;
+	  if (SSE_CLASS_P (classes[0]))
+	    {
+	      a->off = CPLAN_SSE (ssecount);
+	      ssecount += n;
+	    }
+	  else
+	    {
+	      a->off = CPLAN_GPR (gprcount);
+	      gprcount += n;
+	    }
+	  plan->loc[i].lo = a->off;
+	}
+      else
+	{
+	  unsigned int j;
+
+	  a->base = FFI_CPLAN_GATHER;
+	  a->n = n;
+	  a->off = scratch;
+	  scratch += FFI_ALIGN (n * 8, 16);
+	  for (j = 0; j < n; j++)
+	    {
+	      if (classes[j] == X86_64_SSEUP_CLASS)
+		a->src[j] = CPLAN_SSE (ssecount - 1) + 8;
+	      else if (SSE_CLASS_P (classes[j]))
+		a->src[j] = CPLAN_SSE (ssecount++);
+	      else
+		a->src[j] = CPLAN_GPR (gprcount++);
+	    }
+	  plan->loc[i].lo = a->src[0];
+	  plan->loc[i].hi = a->src[1];
+	  continue;
+	}
+      plan->loc[i].hi = plan->loc[i].lo + 8;
+    }
+  plan->scratch = scratch;
+
+  return plan;
+}
+
+void
+ffi_closure_plan_free (ffi_closure_plan *plan)
+{
+  free (plan);
+}
+
+ffi_status
+ffi_prep_closure_plan_loc (ffi_closure *closure, ffi_closure_plan *plan,
+			   void (*fun)(ffi_cif*, void*, void**, void*),
+			   void *user_data, void *codeloc)
+{
+  if (!plan->direct)
+    return ffi_prep_closure_loc (closure, plan->orig, fun, user_data,
+				 codeloc);
+
+  if (plan->cif.flags & UNIX64_FLAG_XMM_ARGS)
+    unix64_set_tramp (closure, ffi_closure_unix64_plan_sse,
+		      UNIX64_ALT (ffi_closure_unix64_plan_sse));
+  else
+    unix64_set_tramp (closure, ffi_closure_unix64_plan,
+		      UNIX64_ALT (ffi_closure_unix64_plan));
+
+  closure->cif = &plan->cif;
+  closure->fun = fun;
+  closure->user_data = user_data;
+
+  return FFI_OK;
+}
+
+extern void ffi_closure_unix64_direct(void) FFI_HIDDEN;
+extern void ffi_closure_unix64_direct_sse(void) FFI_HIDDEN;
+#if defined(FFI_EXEC_STATIC_TRAMP)
+extern void ffi_closure_unix64_direct_alt(void) FFI_HIDDEN;
+extern void ffi_closure_unix64_direct_sse_alt(void) FFI_HIDDEN;
+#endif
+
+ffi_status
+ffi_prep_direct_closure_loc (ffi_direct_closure *closure,
+			     ffi_closure_plan *plan,
+			     void (*fun)(ffi_cif*, void*, char*,
+					 const ffi_direct_loc*, void*),
+			     void *user_data, void *codeloc)
+{
+  (void) codeloc;
+  if (!plan->direct)
+    return FFI_BAD_ABI;
+
+  /* The trampoline prefix is laid out as in ffi_closure.  */
+  if (plan->cif.flags & UNIX64_FLAG_XMM_ARGS)
+    unix64_set_tramp ((ffi_closure *) closure, ffi_closure_unix64_direct_sse,
+		      UNIX64_ALT (ffi_closure_unix64_direct_sse));
+  else
+    unix64_set_tramp ((ffi_closure *) closure, ffi_closure_unix64_direct,
+		      UNIX64_ALT (ffi_closure_unix64_direct));
+
+  closure->cif = plan->orig;
+  closure->fun = fun;
+  closure->user_data = user_data;
+  closure->loc = plan->loc;
+
+  return FFI_OK;
+}
+
+int FFI_HIDDEN
+ffi_closure_unix64_direct_inner(ffi_cif *cif,
+				void (*fun)(ffi_cif*, void*, char*,
+					    const ffi_direct_loc*, void*),
+				void *user_data,
+				void *rvalue,
+				struct register_args *reg_args,
+				const ffi_direct_loc *loc)
+{
+  int flags = cif->flags;
+
+  if (flags & UNIX64_FLAG_RET_IN_MEM)
+    {
+      void *r = (void *)(uintptr_t)reg_args->gpr[0];
+      *(void **)rvalue = r;
+      rvalue = r;
+      flags = UNIX64_RET_INT64;
+    }
+
+  fun (cif, rvalue, (char *) reg_args, loc, user_data);
+
+  return flags;
+}
+
+int FFI_HIDDEN
+ffi_closure_unix64_plan_inner(ffi_closure_plan *plan,
+			      void (*fun)(ffi_cif*, void*, void**, void*),
+			      void *user_data,
+			      void *rvalue,
+			      struct register_args *reg_args,
+			      char *argp)
+{
+  unsigned i, avn = plan->cif.nargs;
+  int flags = plan->cif.flags;
+  char *scratch;
+  void **avalue;
+
+  /* Scratch first: alloca is 16-byte aligned, as gathered SSE pairs need. */
+  scratch = alloca (plan->scratch + avn * sizeof (void *));
+  avalue = (void **) (scratch + plan->scratch);
+
+  if (flags & UNIX64_FLAG_RET_IN_MEM)
+    {
+      void *r = (void *)(uintptr_t)reg_args->gpr[0];
+      *(void **)rvalue = r;
+      rvalue = r;
+      flags = UNIX64_RET_INT64;
+    }
+
+  for (i = 0; i < avn; i++)
+    {
+      const ffi_cplan_arg *a = &plan->args[i];
+
+      switch (a->base)
+	{
+	case FFI_CPLAN_REGS:
+	  avalue[i] = (char *) reg_args + a->off;
+	  break;
+	case FFI_CPLAN_STACK:
+	  avalue[i] = argp + a->off;
+	  break;
+	default:
+	  {
+	    char *d = scratch + a->off;
+	    unsigned j;
+
+	    for (j = 0; j < a->n; j++)
+	      memcpy (d + j * 8, (char *) reg_args + a->src[j], 8);
+	    avalue[i] = d;
+	  }
+	  break;
+	}
+    }
+
+  fun (plan->orig, rvalue, avalue, user_data);
+
+  return flags;
+}
+
+#endif /* !__ILP32__ */
+
 #ifdef FFI_GO_CLOSURES
 
 extern void ffi_go_closure_unix64(void) FFI_HIDDEN;
@@ -140,6 +140,13 @@ typedef enum ffi_abi {
 #define FFI_CLOSURES 1
 #define FFI_GO_CLOSURES 1
 
+/* Direct closures (ffi_direct_closure) read their arguments in place from
+   the saved registers; only the ffi64.c (FFI_UNIX64) backend has them.  */
+#if (defined(X86_64) || (defined (__x86_64__) && defined (X86_DARWIN))) \
+    && !defined(X86_WIN64) && !defined(__ILP32__)
+#define FFI_DIRECT_CLOSURES 1
+#endif
+
 #define FFI_TYPE_SMALL_STRUCT_1B (FFI_TYPE_LAST + 1)
 #define FFI_TYPE_SMALL_STRUCT_2B (FFI_TYPE_LAST + 2)
 #define FFI_TYPE_SMALL_STRUCT_4B (FFI_TYPE_LAST + 3)
@@ -243,6 +243,224 @@ EFI64(ffi_call_go)(ffi_cif *cif, void (*fn)(void), void *rvalue,
   ffi_call_int (cif, fn, rvalue, avalue, closure);
 }
 
+/* Reusable call plans.  Every Win64 argument owns one 8-byte slot, so a
+   plan only has to remember, per argument, how ffi_call_int fills that
+   slot: a zero-extending load, the address of the caller's value, or the
+   address of a private copy for by-value aggregates and int128.  All the
+   copies of one call share a single area whose layout is fixed here.  */
+
+enum win64_plan_op
+{
+  WIN64_PLAN_LOAD8,
+  WIN64_PLAN_LOAD4,
+  WIN64_PLAN_LOAD2,
+  WIN64_PLAN_LOAD1,
+  WIN64_PLAN_REF,		/* pass avalue[i] itself		*/
+  WIN64_PLAN_COPY		/* pass a copy at COPY_OFF		*/
+};
+
+struct win64_plan_move
+{
+  unsigned op;			/* enum win64_plan_op			*/
+  unsigned size;		/* bytes copied by COPY			*/
+  unsigned copy_off;		/* COPY: offset in the copy area	*/
+};
+
+struct win64_plan
+{
+  ffi_cif *cif;
+  unsigned first;		/* slot of the first argument		*/
+  unsigned copy_bytes;		/* size of the copy area		*/
+  size_t alloc_bytes;
+  struct win64_plan_move moves[];
+};
+
+/* EFI64() would put the visibility attribute on the pointer type.  */
+#ifdef X86_WIN64
+struct win64_plan *ffi_win64_plan_alloc (ffi_cif *cif);
+#else
+#define ffi_win64_plan_alloc ffi_win64_plan_alloc_efi64
+struct win64_plan *ffi_win64_plan_alloc (ffi_cif *cif) FFI_HIDDEN;
+#endif
+
+struct win64_plan *
+ffi_win64_plan_alloc (ffi_cif *cif)
+{
+  struct win64_plan *plan;
+  unsigned copy_bytes = 0;
+  int i, nargs = cif->nargs;
+  size_t nbytes;
+
+  FFI_ASSERT(cif->abi == FFI_GNUW64 || cif->abi == FFI_WIN64);
+
+  nbytes = sizeof (struct win64_plan)
+	   + sizeof (struct win64_plan_move) * nargs;
+  plan = malloc (nbytes);
+  if (plan == NULL)
+    return NULL;
+  plan->cif = cif;
+  plan->first = (cif->flags == FFI_TYPE_STRUCT);
+  plan->alloc_bytes = nbytes;
+
+  /* Mirrors the copy decision and slot fill in ffi_call_int.  */
+  for (i = 0; i < nargs; i++)
+    {
+      ffi_type *at = cif->arg_types[i];
+      struct win64_plan_move *m = &plan->moves[i];
+      unsigned size = at->size;
+      bool needcopy = false;
+
+      switch (at->type)
+	{
+	case FFI_TYPE_UINT128:
+	case FFI_TYPE_SINT128:
+	  needcopy = true;
+	  break;
+	case FFI_TYPE_STRUCT:
+	  needcopy = !(size == 1 || size == 2 || size == 4 || size == 8);
+	  break;
+	}
+
+      m->size = size;
+      m->copy_off = 0;
+      if (needcopy)
+	{
+	  m->op = WIN64_PLAN_COPY;
+	  m->copy_off = copy_bytes;
+	  copy_bytes += FFI_ALIGN (size, 16);
+	}
+      else
+	switch (size)
+	  {
+	  case 8: m->op = WIN64_PLAN_LOAD8; break;
+	  case 4: m->op = WIN64_PLAN_LOAD4; break;
+	  case 2: m->op = WIN64_PLAN_LOAD2; break;
+	  case 1: m->op = WIN64_PLAN_LOAD1; break;
+	  default: m->op = WIN64_PLAN_REF; break;
+	  }
+    }
+  plan->copy_bytes = copy_bytes;
+
+  return plan;
+}
+
+size_t
+EFI64(ffi_win64_plan_size)(struct win64_plan *plan)
+{
+  return plan->alloc_bytes;
+}
+
+#if defined(_MSC_VER)
+#pragma runtime_checks("s", off)
+#endif
+FFI_ASAN_NO_SANITIZE
+void
+EFI64(ffi_win64_plan_invoke)(struct win64_plan *plan, void (*fn)(void),
+			     void *rvalue, void **avalue)
+{
+  ffi_cif *cif = plan->cif;
+  int i, n = cif->nargs, flags = cif->flags;
+  struct win64_call_frame *frame;
+  UINT64 *stack, *slot;
+  char *copies;
+  size_t rsize = 0;
+
+  if (rvalue == NULL)
+    {
+      if (flags == FFI_TYPE_STRUCT)
+	rsize = cif->rtype->size;
+      else
+	flags = FFI_TYPE_VOID;
+    }
+
+  /* Same layout as ffi_call_int, with the argument copies placed after
+     the frame and the scratch return value.  */
+  stack = alloca (cif->bytes + sizeof (struct win64_call_frame) + rsize
+		  + plan->copy_bytes + 15);
+  frame = (struct win64_call_frame *)((char *)stack + cif->bytes);
+  if (rsize)
+    rvalue = frame + 1;
+  copies = (char *) FFI_ALIGN ((char *)(frame + 1) + rsize, 16);
+
+  frame->fn = (uintptr_t)fn;
+  frame->flags = flags;
+  frame->rvalue = (uintptr_t)rvalue;
+
+  if (plan->first)
+    stack[0] = (uintptr_t)rvalue;
+
+  slot = stack + plan->first;
+  for (i = 0; i < n; i++)
+    {
+      const struct win64_plan_move *m = &plan->moves[i];
+      void *a = avalue[i];
+
+      switch (m->op)
+	{
+	case WIN64_PLAN_LOAD8:
+	  slot[i] = *(UINT64 *)a;
+	  break;
+	case WIN64_PLAN_LOAD4:
+	  slot[i] = *(UINT32 *)a;
+	  break;
+	case WIN64_PLAN_LOAD2:
+	  slot[i] = *(UINT16 *)a;
+	  break;
+	case WIN64_PLAN_LOAD1:
+	  slot[i] = *(UINT8 *)a;
+	  break;
+	case WIN64_PLAN_REF:
+	  slot[i] = (uintptr_t)a;
+	  break;
+	case WIN64_PLAN_COPY:
+	  slot[i] = (uintptr_t)memcpy (copies + m->copy_off, a, m->size);
+	  break;
+	}
+    }
+
+  ffi_call_win64 (stack, frame, NULL);
+}
+#if defined(_MSC_VER)
+#pragma runtime_checks("s", restore)
+#endif
+
+#ifdef X86_WIN64
+/* Native Win64 builds have no other backend: the public plan is the Win64
+   plan itself.  */
+ffi_call_plan *
+ffi_call_plan_alloc (ffi_cif *cif)
+{
+  return (ffi_call_plan *) ffi_win64_plan_alloc (cif);
+}
+
+ffi_call_plan *
+ffi_call_plan_alloc_flags (ffi_cif *cif, unsigned int flags)
+{
+  /* No FFI_CALL_PLAN_* option is implemented for Win64.  */
+  (void) flags;
+  return ffi_call_plan_alloc (cif);
+}
+
+void
+ffi_call_plan_invoke (ffi_call_plan *plan, void (*fn)(void), void *rvalue,
+		      void **avalue)
+{
+  ffi_win64_plan_invoke ((struct win64_plan *) plan, fn, rvalue, avalue);
+}
+
+void
+ffi_call_plan_free (ffi_call_plan *plan)
+{
+  free (plan);
+}
+
+size_t
+ffi_call_plan_size (ffi_call_plan *plan)
+{
+  return plan != NULL ? ffi_win64_plan_size ((struct win64_plan *) plan) : 0;
+}
+#endif /* X86_WIN64 */
+
 
 extern void ffi_closure_win64(void) FFI_HIDDEN;
 #if defined(FFI_EXEC_STATIC_TRAMP)
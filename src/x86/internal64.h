@@ -22,6 +22,10 @@
 #define UNIX64_FLAG_XMM_ARGS	(1 << 11)
 #define UNIX64_SIZE_SHIFT	12
 
+/* Offset of the first stack argument from the register_args a closure
+   saves at the bottom of its frame: ffi_closure_FS + 8 in unix64.S.  */
+#define UNIX64_CLOSURE_ARGP	224
+
 #if defined(FFI_EXEC_STATIC_TRAMP)
 /*
  * For the trampoline code table mapping, a mapping size of 4K (base page size)
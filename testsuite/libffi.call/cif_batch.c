@@ -0,0 +1,212 @@
+/* Area:	ffi_prep_cif_batch, ffi_cif_batch_free, ffi_cif_batch_size
+   Purpose:	Check that a batch shares one cif and plan between identical
+		descriptors and none between different ones, reports a
+		failed signature without disturbing the rest, copies the
+		argument type arrays, and yields cifs and plans that call
+		correctly, including a variadic signature and a batch
+		prepared on several threads.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_prep_cif_batch tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+#include <stdarg.h>
+
+#define NDESCS 64
+#define NDISTINCT 16
+
+struct pair { long a; double b; };
+
+static long add3(long a, long b, long c)
+{
+  return a + b * 2 + c * 3;
+}
+
+static double take_pair(struct pair p, int k)
+{
+  return p.a * k + p.b;
+}
+
+static long vsum(int n, ...)
+{
+  va_list ap;
+  long r = 0;
+  int i;
+
+  va_start(ap, n);
+  for (i = 0; i < n; i++)
+    r += va_arg(ap, long) * (i + 1);
+  va_end(ap);
+  return r;
+}
+
+static long sum_n(long a, long b, long c, long d, long e, long f, long g,
+		  long h, long i, long j, long k, long l, long m, long n,
+		  long o, long p)
+{
+  return a + b + c + d + e + f + g + h + i + j + k + l + m + n + o + p;
+}
+
+int main (void)
+{
+  ffi_cif_desc descs[6];
+  ffi_cif *cifs[6];
+  ffi_call_plan *plans[6];
+  ffi_status status[6];
+  ffi_type *l3[3], *l3b[3], *pk[2], *vl[3], *l2[2];
+  ffi_type pair_t;
+  ffi_type *pair_e[3];
+  ffi_cif_batch *batch;
+  int i;
+
+  pair_e[0] = &ffi_type_slong;
+  pair_e[1] = &ffi_type_double;
+  pair_e[2] = NULL;
+  pair_t.size = pair_t.alignment = 0;
+  pair_t.type = FFI_TYPE_STRUCT;
+  pair_t.elements = pair_e;
+
+  l3[0] = l3[1] = l3[2] = &ffi_type_slong;
+  l3b[0] = l3b[1] = l3b[2] = &ffi_type_slong;
+  pk[0] = &pair_t;
+  pk[1] = &ffi_type_sint;
+  vl[0] = &ffi_type_sint;
+  vl[1] = vl[2] = &ffi_type_slong;
+  l2[0] = l2[1] = &ffi_type_slong;
+
+  memset(descs, 0, sizeof(descs));
+  /* 0 and 1 are the same signature through different arrays.  */
+  descs[0].abi = FFI_DEFAULT_ABI;
+  descs[0].nargs = 3;
+  descs[0].rtype = &ffi_type_slong;
+  descs[0].atypes = l3;
+  descs[1] = descs[0];
+  descs[1].atypes = l3b;
+  descs[2].abi = FFI_DEFAULT_ABI;
+  descs[2].nargs = 2;
+  descs[2].rtype = &ffi_type_double;
+  descs[2].atypes = pk;
+  descs[3].abi = FFI_DEFAULT_ABI;
+  descs[3].nargs = 3;
+  descs[3].nfixedargs = 1;
+  descs[3].variadic = 1;
+  descs[3].rtype = &ffi_type_slong;
+  descs[3].atypes = vl;
+  /* A bad ABI fails alone.  */
+  descs[4] = descs[0];
+  descs[4].abi = FFI_LAST_ABI;
+  /* Fewer arguments: not the same signature as 0.  */
+  descs[5] = descs[0];
+  descs[5].nargs = 2;
+  descs[5].atypes = l2;
+
+  batch = ffi_prep_cif_batch(descs, 6, cifs, plans, status, 1);
+  CHECK(batch != NULL);
+  CHECK(ffi_cif_batch_size(batch) == 5);
+  CHECK(status[0] == FFI_OK && status[1] == FFI_OK && status[2] == FFI_OK);
+  CHECK(status[3] == FFI_OK && status[5] == FFI_OK);
+  CHECK(status[4] == FFI_BAD_ABI);
+  CHECK(cifs[4] == NULL && plans[4] == NULL);
+  CHECK(cifs[0] == cifs[1] && plans[0] == plans[1]);
+  CHECK(cifs[0] != cifs[5] && cifs[0] != cifs[3]);
+  for (i = 0; i < 6; i++)
+    if (i != 4)
+      CHECK(plans[i] != NULL);
+
+  /* The arrays were copied: scribbling on them changes nothing.  */
+  CHECK(cifs[0]->arg_types != l3 && cifs[0]->arg_types != l3b);
+  l3[2] = l3b[2] = &ffi_type_sint;
+  CHECK(cifs[0]->arg_types[2] == &ffi_type_slong);
+  CHECK(pair_t.size == sizeof(struct pair));
+
+  {
+    long a = 3, b = -4, c = 1000;
+    void *values[3];
+    ffi_arg rc, rp;
+
+    values[0] = &a;
+    values[1] = &b;
+    values[2] = &c;
+    ffi_call(cifs[1], FFI_FN(add3), &rc, values);
+    ffi_call_plan_invoke(plans[0], FFI_FN(add3), &rp, values);
+    CHECK((long) rc == add3(a, b, c));
+    CHECK(rc == rp);
+  }
+
+  {
+    struct pair p;
+    int k = -7;
+    void *values[2];
+    double rc, rp;
+
+    p.a = 12;
+    p.b = 0.25;
+    values[0] = &p;
+    values[1] = &k;
+    ffi_call(cifs[2], FFI_FN(take_pair), &rc, values);
+    ffi_call_plan_invoke(plans[2], FFI_FN(take_pair), &rp, values);
+    CHECK_DOUBLE_EQ(rc, take_pair(p, k));
+    CHECK_DOUBLE_EQ(rc, rp);
+  }
+
+  {
+    int n = 2;
+    long x = 5, y = -9;
+    void *values[3];
+    ffi_arg rc;
+
+    values[0] = &n;
+    values[1] = &x;
+    values[2] = &y;
+    ffi_call(cifs[3], FFI_FN(vsum), &rc, values);
+    CHECK((long) rc == vsum(n, x, y));
+  }
+
+  ffi_cif_batch_free(batch);
+
+  /* Without plans or statuses, on several threads, over descriptors that
+     repeat NDISTINCT signatures.  */
+  {
+    static ffi_cif_desc many[NDESCS];
+    static ffi_type *types[NDISTINCT][NDISTINCT];
+    ffi_cif *mcifs[NDESCS];
+    long v[NDISTINCT];
+    void *values[NDISTINCT];
+    ffi_arg rc;
+    int j;
+
+    for (j = 0; j < NDISTINCT; j++)
+      {
+	for (i = 0; i < NDISTINCT; i++)
+	  types[j][i] = &ffi_type_slong;
+	v[j] = j * 3 - 5;
+	values[j] = &v[j];
+      }
+    for (i = 0; i < NDESCS; i++)
+      {
+	many[i].abi = FFI_DEFAULT_ABI;
+	many[i].nargs = i % NDISTINCT + 1;
+	many[i].rtype = &ffi_type_slong;
+	many[i].atypes = types[i % NDISTINCT];
+      }
+
+    batch = ffi_prep_cif_batch(many, NDESCS, mcifs, NULL, NULL, 4);
+    CHECK(batch != NULL);
+    CHECK(ffi_cif_batch_size(batch) == NDISTINCT);
+    for (i = 0; i < NDESCS; i++)
+      {
+	CHECK(mcifs[i] != NULL);
+	CHECK(mcifs[i] == mcifs[i % NDISTINCT]);
+	CHECK(mcifs[i]->nargs == (unsigned) (i % NDISTINCT + 1));
+      }
+    ffi_call(mcifs[NDISTINCT - 1], FFI_FN(sum_n), &rc, values);
+    CHECK((long) rc == sum_n(v[0], v[1], v[2], v[3], v[4], v[5], v[6],
+			     v[7], v[8], v[9], v[10], v[11], v[12], v[13],
+			     v[14], v[15]));
+    ffi_cif_batch_free(batch);
+  }
+
+  ffi_cif_batch_free(NULL);
+  exit(0);
+}
@@ -0,0 +1,141 @@
+/* Area:	ffi_cif_intern, ffi_cif_intern_var, ffi_cif_intern_plan
+   Purpose:	Check that identical signatures share one prepared cif and
+		one plan, that signatures differing in any part of the key
+		do not, that a failed signature is reported and not kept,
+		and that the shared cif calls correctly.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_cif_intern tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define NSIGS 500
+
+struct pair { long a; double b; };
+
+static long add3(long a, long b, long c)
+{
+  return a + b * 2 + c * 3;
+}
+
+static double take_pair(struct pair p, int k)
+{
+  return p.a * k + p.b;
+}
+
+int main (void)
+{
+  ffi_type *args[3], *other[3];
+  ffi_type pair_t;
+  ffi_type *pair_e[3];
+  static ffi_type wrap_t[NSIGS];
+  static ffi_type *wrap_e[2] = { &ffi_type_sint, NULL };
+  ffi_cif *cif, *again, *cifs[NSIGS];
+  ffi_call_plan *plan;
+  ffi_status status;
+  int i;
+
+  args[0] = args[1] = args[2] = &ffi_type_slong;
+  cif = ffi_cif_intern(FFI_DEFAULT_ABI, 3, &ffi_type_slong, args, &status);
+  CHECK(cif != NULL && status == FFI_OK);
+  CHECK(cif->nargs == 3 && cif->rtype == &ffi_type_slong);
+  /* The argument type array is copied.  */
+  CHECK(cif->arg_types != args);
+
+  /* Same key through a different array: same cif.  */
+  other[0] = other[1] = other[2] = &ffi_type_slong;
+  again = ffi_cif_intern(FFI_DEFAULT_ABI, 3, &ffi_type_slong, other, NULL);
+  CHECK(again == cif);
+
+  /* Any part of the key changed: another cif.  */
+  other[2] = &ffi_type_uint;
+  CHECK(ffi_cif_intern(FFI_DEFAULT_ABI, 3, &ffi_type_slong, other, NULL)
+	!= cif);
+  CHECK(ffi_cif_intern(FFI_DEFAULT_ABI, 2, &ffi_type_slong, args, NULL)
+	!= cif);
+  CHECK(ffi_cif_intern(FFI_DEFAULT_ABI, 3, &ffi_type_uint, args, NULL)
+	!= cif);
+  again = ffi_cif_intern_var(FFI_DEFAULT_ABI, 1, 3, &ffi_type_slong, args,
+			     NULL);
+  CHECK(again != NULL && again != cif);
+  CHECK(ffi_cif_intern_var(FFI_DEFAULT_ABI, 2, 3, &ffi_type_slong, args,
+			   NULL) != again);
+  CHECK(ffi_cif_intern_var(FFI_DEFAULT_ABI, 1, 3, &ffi_type_slong, args,
+			   NULL) == again);
+
+  /* A bad ABI is reported and never cached.  */
+  status = FFI_OK;
+  CHECK(ffi_cif_intern(FFI_LAST_ABI, 3, &ffi_type_slong, args, &status)
+	== NULL);
+  CHECK(status == FFI_BAD_ABI);
+  status = FFI_OK;
+  CHECK(ffi_cif_intern(FFI_LAST_ABI, 3, &ffi_type_slong, args, &status)
+	== NULL);
+  CHECK(status == FFI_BAD_ABI);
+
+  /* One shared plan per cif.  */
+  plan = ffi_cif_intern_plan(cif);
+  CHECK(plan != NULL);
+  CHECK(ffi_cif_intern_plan(cif) == plan);
+  {
+    long a = 5, b = -7, c = 11;
+    void *values[3];
+    ffi_arg rc, rp;
+
+    values[0] = &a;
+    values[1] = &b;
+    values[2] = &c;
+    ffi_call(cif, FFI_FN(add3), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(add3), &rp, values);
+    CHECK((long) rc == add3(a, b, c));
+    CHECK(rc == rp);
+  }
+
+  /* A struct argument, prepared once through the cache.  */
+  pair_e[0] = &ffi_type_slong;
+  pair_e[1] = &ffi_type_double;
+  pair_e[2] = NULL;
+  pair_t.size = pair_t.alignment = 0;
+  pair_t.type = FFI_TYPE_STRUCT;
+  pair_t.elements = pair_e;
+  other[0] = &pair_t;
+  other[1] = &ffi_type_sint;
+  cif = ffi_cif_intern(FFI_DEFAULT_ABI, 2, &ffi_type_double, other, NULL);
+  CHECK(cif != NULL && pair_t.size == sizeof(struct pair));
+  CHECK(ffi_cif_intern(FFI_DEFAULT_ABI, 2, &ffi_type_double, other, NULL)
+	== cif);
+  {
+    struct pair p;
+    int k = 3;
+    void *values[2];
+    double r;
+
+    p.a = -4;
+    p.b = 0.5;
+    values[0] = &p;
+    values[1] = &k;
+    ffi_call(cif, FFI_FN(take_pair), &r, values);
+    CHECK_DOUBLE_EQ(r, take_pair(p, k));
+  }
+
+  /* Enough distinct signatures to grow the table, all still found.  */
+  for (i = 0; i < NSIGS; i++)
+    {
+      wrap_t[i].size = wrap_t[i].alignment = 0;
+      wrap_t[i].type = FFI_TYPE_STRUCT;
+      wrap_t[i].elements = wrap_e;
+      other[0] = &wrap_t[i];
+      cifs[i] = ffi_cif_intern(FFI_DEFAULT_ABI, 1, &ffi_type_void, other,
+			       NULL);
+      CHECK(cifs[i] != NULL);
+    }
+  for (i = 0; i < NSIGS; i++)
+    {
+      other[0] = &wrap_t[i];
+      CHECK(ffi_cif_intern(FFI_DEFAULT_ABI, 1, &ffi_type_void, other, NULL)
+	    == cifs[i]);
+    }
+
+  exit(0);
+}
@@ -1,8 +1,7 @@
 /* Area:	ffi_call_plan
    Purpose:	Check that a reusable call plan reproduces ffi_call for the
 		pure-GP64 fast path, pointer arguments and repeated reuse,
-		and that a signature with no fast path still yields a usable
-		plan that falls back to ffi_call.
+		and a small struct argument.
    Limitations:	none.
    PR:		none.
    Originator:	ffi_call_plan tests  */
@@ -84,9 +83,9 @@ int main (void)
     ffi_call_plan_free(planp);
   }
 
-  /* No fast path: a struct-by-value argument.  build_plan returns NULL for
-     the fast plan, but ffi_call_plan_alloc must still hand back a valid plan
-     whose invoke falls back to ffi_call and produces the same result.  */
+  /* A struct-by-value argument.  On targets with a move list the struct is
+     split into its register eightbytes; elsewhere the plan falls back to
+     ffi_call.  Either way invoke must produce the same result.  */
   {
     ffi_cif cifs;
     ffi_type *sargs[1];
@@ -0,0 +1,151 @@
+/* Area:	ffi_call_plan
+   Purpose:	Check that a reusable call plan reproduces ffi_call under
+		ABI_NUM, which the testsuite also runs with the Win64 ABI on
+		x86-64: narrow integers, floating-point slots, stack slots,
+		by-value aggregates passed through a private copy, and an
+		in-memory struct return.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_call_plan tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+struct ii { int a, b; };
+struct iii { int a, b, c; };
+struct big { long long x, y, z; };
+
+static long long ABI_ATTR
+take_mix(signed char a, unsigned short b, double c, float d, int e,
+	 struct ii f, long long g)
+{
+  return a + b * 2 + (long long) (c * 4) + (long long) (d * 8) + e * 3
+    + f.a * 5 + f.b * 7 + g;
+}
+
+/* The callee scribbles on its by-value copy; the caller's must survive.  */
+static int ABI_ATTR
+take_iii(struct iii s, int k)
+{
+  int r = s.a + s.b * k + s.c;
+  s.a = s.b = s.c = -1;
+  return r;
+}
+
+static struct big ABI_ATTR
+make_big(long long x, double y, struct iii s)
+{
+  struct big r;
+  r.x = x;
+  r.y = (long long) y;
+  r.z = s.a + s.b + s.c;
+  return r;
+}
+
+static ffi_type *
+make_struct (ffi_type *t, ffi_type **elts, ffi_type *e, int n)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    elts[i] = e;
+  elts[n] = NULL;
+  t->size = t->alignment = 0;
+  t->type = FFI_TYPE_STRUCT;
+  t->elements = elts;
+  return t;
+}
+
+int main (void)
+{
+  ffi_type ii_t, iii_t, big_t;
+  ffi_type *ii_e[3], *iii_e[4], *big_e[4];
+  struct iii s3 = { 3, 4, 5 };
+
+  make_struct (&ii_t, ii_e, &ffi_type_sint, 2);
+  make_struct (&iii_t, iii_e, &ffi_type_sint, 3);
+  make_struct (&big_t, big_e, &ffi_type_sint64, 3);
+
+  /* Register and stack slots with every load width.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[7];
+    void *values[7];
+    ffi_call_plan *plan;
+    signed char a = -3;
+    unsigned short b = 60000;
+    double c = 2.5;
+    float d = -0.5f;
+    int e = -77;
+    struct ii f = { 11, -13 };
+    long long g = 1LL << 40, rc, rp;
+
+    args[0] = &ffi_type_schar;   values[0] = &a;
+    args[1] = &ffi_type_ushort;  values[1] = &b;
+    args[2] = &ffi_type_double;  values[2] = &c;
+    args[3] = &ffi_type_float;   values[3] = &d;
+    args[4] = &ffi_type_sint;    values[4] = &e;
+    args[5] = &ii_t;             values[5] = &f;
+    args[6] = &ffi_type_sint64;  values[6] = &g;
+    CHECK(ffi_prep_cif(&cif, ABI_NUM, 7, &ffi_type_sint64, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+    CHECK(ffi_call_plan_size(plan) > 0);
+
+    ffi_call(&cif, FFI_FN(take_mix), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(take_mix), &rp, values);
+    CHECK(rc == rp);
+    CHECK(rp == take_mix(a, b, c, d, e, f, g));
+    ffi_call_plan_invoke(plan, FFI_FN(take_mix), NULL, values);
+    ffi_call_plan_free(plan);
+  }
+
+  /* A 12-byte struct goes through a copy of the caller's value.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[2];
+    void *values[2];
+    ffi_call_plan *plan;
+    int k = 6;
+    ffi_arg rc, rp;
+
+    args[0] = &iii_t;          values[0] = &s3;
+    args[1] = &ffi_type_sint;  values[1] = &k;
+    CHECK(ffi_prep_cif(&cif, ABI_NUM, 2, &ffi_type_sint, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(take_iii), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(take_iii), &rp, values);
+    CHECK((int) rc == (int) rp);
+    CHECK((int) rp == 3 + 4 * 6 + 5);
+    CHECK(s3.a == 3 && s3.b == 4 && s3.c == 5);
+    ffi_call_plan_free(plan);
+  }
+
+  /* In-memory struct return, including a discarded one.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[3];
+    void *values[3];
+    ffi_call_plan *plan;
+    long long x = -123456789LL;
+    double y = 42.0;
+    struct big rc, rp;
+
+    args[0] = &ffi_type_sint64;  values[0] = &x;
+    args[1] = &ffi_type_double;  values[1] = &y;
+    args[2] = &iii_t;            values[2] = &s3;
+    CHECK(ffi_prep_cif(&cif, ABI_NUM, 3, &big_t, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(make_big), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(make_big), &rp, values);
+    CHECK(rc.x == rp.x && rc.y == rp.y && rc.z == rp.z);
+    CHECK(rp.x == x && rp.y == 42 && rp.z == 12);
+    ffi_call_plan_invoke(plan, FFI_FN(make_big), NULL, values);
+    ffi_call_plan_free(plan);
+  }
+
+  exit(0);
+}
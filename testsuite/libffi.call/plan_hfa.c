@@ -0,0 +1,83 @@
+/* Area:	ffi_call_plan
+   Purpose:	Check that a reusable call plan reproduces ffi_call for
+		homogeneous floating-point aggregates: float and double
+		structs of two to four members, enough of them to exhaust
+		the vector registers, and an HFA return.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_call_plan tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+struct f4 { float a, b, c, d; };
+struct d3 { double x, y, z; };
+struct d2 { double x, y; };
+
+static struct d2 blend(struct f4 p, struct d3 q, struct f4 r, struct d3 s,
+		       int k, struct d3 t)
+{
+  struct d2 o;
+  o.x = p.a + p.b * 2 + p.c * 3 + p.d * 4 + q.x * 5 + q.y * 6 + q.z * 7
+    + r.a * 8 + r.d * 9 + s.x * 10 + s.z * 11 + t.y * 12;
+  o.y = k * (p.d - r.c) + s.y - t.x + t.z;
+  return o;
+}
+
+static ffi_type *
+make_struct (ffi_type *t, ffi_type **elts, ffi_type *e, int n)
+{
+  int i;
+  for (i = 0; i < n; i++)
+    elts[i] = e;
+  elts[n] = NULL;
+  t->size = t->alignment = 0;
+  t->type = FFI_TYPE_STRUCT;
+  t->elements = elts;
+  return t;
+}
+
+int main (void)
+{
+  ffi_type f4_t, d3_t, d2_t;
+  ffi_type *f4_e[5], *d3_e[4], *d2_e[3];
+  ffi_type *args[6];
+  void *values[6];
+  ffi_cif cif;
+  ffi_call_plan *plan;
+  struct f4 p = { 1.0f, 2.0f, 3.0f, 4.0f }, r = { -1.5f, 0.5f, 2.5f, 8.0f };
+  struct d3 q = { 0.25, 0.5, 0.75 }, s = { -2.0, 3.0, 5.0 };
+  struct d3 t = { 10.0, 20.0, 30.0 };
+  struct d2 rc, rp;
+  int k = 3, i;
+
+  make_struct (&f4_t, f4_e, &ffi_type_float, 4);
+  make_struct (&d3_t, d3_e, &ffi_type_double, 3);
+  make_struct (&d2_t, d2_e, &ffi_type_double, 2);
+
+  args[0] = &f4_t;          values[0] = &p;
+  args[1] = &d3_t;          values[1] = &q;
+  args[2] = &f4_t;          values[2] = &r;
+  args[3] = &d3_t;          values[3] = &s;
+  args[4] = &ffi_type_sint; values[4] = &k;
+  args[5] = &d3_t;          values[5] = &t;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 6, &d2_t, args) == FFI_OK);
+  plan = ffi_call_plan_alloc(&cif);
+  CHECK(plan != NULL);
+
+  for (i = 0; i < 3; i++)
+    {
+      t.y += 1.0;
+      p.c -= 0.5f;
+      ffi_call(&cif, FFI_FN(blend), &rc, values);
+      ffi_call_plan_invoke(plan, FFI_FN(blend), &rp, values);
+      CHECK_DOUBLE_EQ(rc.x, rp.x);
+      CHECK_DOUBLE_EQ(rc.y, rp.y);
+      CHECK_DOUBLE_EQ(rp.x, blend(p, q, r, s, k, t).x);
+      CHECK_DOUBLE_EQ(rp.y, blend(p, q, r, s, k, t).y);
+    }
+  ffi_call_plan_invoke(plan, FFI_FN(blend), NULL, values);
+  ffi_call_plan_free(plan);
+
+  exit(0);
+}
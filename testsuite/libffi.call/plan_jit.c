@@ -0,0 +1,215 @@
+/* Area:	ffi_call_plan_alloc_flags
+   Purpose:	Check that a plan built with FFI_CALL_PLAN_JIT reproduces
+		ffi_call for narrow signed and unsigned integers, mixed
+		GP/SSE arguments, small struct arguments, in-memory struct
+		returns and a signature with stack arguments, whether or not
+		the target actually generates code for it, and that many
+		generated stubs can live at once.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_call_plan tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define NPLANS 200
+
+struct fff { float a, b, c; };
+struct big3 { double a, b, c; };
+
+static long narrow(signed char a, unsigned char b, short c,
+		   unsigned short d, int e, unsigned f)
+{
+  return a * 1 + b * 2 + c * 3 + d * 4 + (long) e * 5 + (long) f * 6;
+}
+
+static double mixed(void *p, double d, int i, float f, struct fff s)
+{
+  return (p != NULL ? 1.0 : 0.0) + d * 2 + i * 3 + f * 4
+    + s.a * 5 + s.b * 6 + s.c * 7;
+}
+
+static struct big3 make_big3(double a, long b)
+{
+  struct big3 r;
+  r.a = a;
+  r.b = (double) b;
+  r.c = a * b;
+  return r;
+}
+
+static long many(long a, long b, long c, long d, long e, long f,
+		 long g, long h)
+{
+  return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;
+}
+
+int main (void)
+{
+  /* Sign and zero extension of every narrow integer width.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[6];
+    void *values[6];
+    ffi_call_plan *plan;
+    signed char a = -5;
+    unsigned char b = 250;
+    short c = -30000;
+    unsigned short d = 65000;
+    int e = -2000000000;
+    unsigned f = 4000000000u;
+    ffi_arg rc, rp;
+    int k;
+
+    args[0] = &ffi_type_schar;   values[0] = &a;
+    args[1] = &ffi_type_uchar;   values[1] = &b;
+    args[2] = &ffi_type_sshort;  values[2] = &c;
+    args[3] = &ffi_type_ushort;  values[3] = &d;
+    args[4] = &ffi_type_sint;    values[4] = &e;
+    args[5] = &ffi_type_uint;    values[5] = &f;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 6, &ffi_type_slong, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc_flags(&cif, FFI_CALL_PLAN_JIT);
+    CHECK(plan != NULL);
+
+    for (k = 0; k < 10; k++)
+      {
+	a = (signed char) (a - 7);
+	f += 12345;
+	ffi_call(&cif, FFI_FN(narrow), &rc, values);
+	ffi_call_plan_invoke(plan, FFI_FN(narrow), &rp, values);
+	CHECK(rc == rp);
+	CHECK((long) rp == narrow(a, b, c, d, e, f));
+      }
+    ffi_call_plan_free(plan);
+
+    /* Many stubs at once share pages: none costs anything like a page,
+       and each still calls correctly.  */
+    {
+      ffi_call_plan *plain, *many_plans[NPLANS];
+      size_t plain_size;
+
+      plain = ffi_call_plan_alloc(&cif);
+      CHECK(plain != NULL);
+      plain_size = ffi_call_plan_size(plain);
+      for (k = 0; k < NPLANS; k++)
+	{
+	  many_plans[k] = ffi_call_plan_alloc_flags(&cif, FFI_CALL_PLAN_JIT);
+	  CHECK(many_plans[k] != NULL);
+	  CHECK(ffi_call_plan_size(many_plans[k]) < plain_size + 1024);
+	}
+      ffi_call(&cif, FFI_FN(narrow), &rc, values);
+      for (k = 0; k < NPLANS; k++)
+	{
+	  ffi_call_plan_invoke(many_plans[k], FFI_FN(narrow), &rp, values);
+	  CHECK(rc == rp);
+	}
+      for (k = 0; k < NPLANS; k++)
+	ffi_call_plan_free(many_plans[k]);
+      ffi_call_plan_free(plain);
+    }
+  }
+
+  /* Pointer, double, int, float and a 12-byte float struct.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[5];
+    void *values[5];
+    ffi_type fff_t;
+    ffi_type *fff_e[4];
+    ffi_call_plan *plan;
+    void *p = &cif;
+    double d = 0.75, rc, rp;
+    int i = -9;
+    float f = 1.5f;
+    struct fff s;
+
+    fff_e[0] = fff_e[1] = fff_e[2] = &ffi_type_float;
+    fff_e[3] = NULL;
+    fff_t.size = fff_t.alignment = 0;
+    fff_t.type = FFI_TYPE_STRUCT;
+    fff_t.elements = fff_e;
+
+    s.a = 1.0f; s.b = -2.0f; s.c = 0.5f;
+    args[0] = &ffi_type_pointer;  values[0] = &p;
+    args[1] = &ffi_type_double;   values[1] = &d;
+    args[2] = &ffi_type_sint;     values[2] = &i;
+    args[3] = &ffi_type_float;    values[3] = &f;
+    args[4] = &fff_t;             values[4] = &s;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 5, &ffi_type_double, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc_flags(&cif, FFI_CALL_PLAN_JIT);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(mixed), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(mixed), &rp, values);
+    CHECK_DOUBLE_EQ(rc, rp);
+    CHECK_DOUBLE_EQ(rp, mixed(p, d, i, f, s));
+    ffi_call_plan_free(plan);
+  }
+
+  /* In-memory struct return: the hidden pointer is the first argument.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[2];
+    void *values[2];
+    ffi_type big3_t;
+    ffi_type *big3_e[4];
+    ffi_call_plan *plan;
+    double a = 2.5;
+    long b = -4;
+    struct big3 rc, rp;
+
+    big3_e[0] = big3_e[1] = big3_e[2] = &ffi_type_double;
+    big3_e[3] = NULL;
+    big3_t.size = big3_t.alignment = 0;
+    big3_t.type = FFI_TYPE_STRUCT;
+    big3_t.elements = big3_e;
+
+    args[0] = &ffi_type_double;  values[0] = &a;
+    args[1] = &ffi_type_slong;   values[1] = &b;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 2, &big3_t, args) == FFI_OK);
+    plan = ffi_call_plan_alloc_flags(&cif, FFI_CALL_PLAN_JIT);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(make_big3), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(make_big3), &rp, values);
+    CHECK_DOUBLE_EQ(rc.a, rp.a);
+    CHECK_DOUBLE_EQ(rc.b, rp.b);
+    CHECK_DOUBLE_EQ(rc.c, rp.c);
+    CHECK_DOUBLE_EQ(rp.c, a * b);
+    ffi_call_plan_invoke(plan, FFI_FN(make_big3), NULL, values);
+    ffi_call_plan_free(plan);
+  }
+
+  /* Stack arguments: no stub, but the option must still yield a plan.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[8];
+    void *values[8];
+    ffi_call_plan *plan;
+    long v[8];
+    ffi_arg rc, rp;
+    int i;
+
+    for (i = 0; i < 8; i++)
+      {
+	args[i] = &ffi_type_slong;
+	v[i] = i * 3 - 10;
+	values[i] = &v[i];
+      }
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 8, &ffi_type_slong, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc_flags(&cif, FFI_CALL_PLAN_JIT);
+    CHECK(plan != NULL);
+    CHECK(ffi_call_plan_size(plan) > 0);
+
+    ffi_call(&cif, FFI_FN(many), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(many), &rp, values);
+    CHECK(rc == rp);
+    CHECK((long) rp == many(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]));
+    ffi_call_plan_free(plan);
+  }
+
+  exit(0);
+}
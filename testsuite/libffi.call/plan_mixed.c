@@ -3,7 +3,9 @@
 		signatures that mix general-purpose and SSE registers, for
 		float and double returns, for signed narrow arguments, and
 		for integer returns narrower than a register (which the plan
-		must widen to ffi_arg exactly as ffi_call does).
+		must widen to ffi_arg exactly as ffi_call does), and for a
+		signature that fills all six GPRs and all eight SSE
+		registers with interleaved floats and doubles.
    Limitations:	none.
    PR:		none.
    Originator:	ffi_call_plan tests  */
@@ -22,6 +24,15 @@ static float faddf(float a, float b)
   return a + b;
 }
 
+/* 6 GP + 8 SSE arguments, interleaved, with floats among the doubles. */
+static double full(short a, double b, float c, void *d, double e, int f,
+		   float g, long h, double i, double j, signed char k,
+		   float l, unsigned m, double n)
+{
+  return a + b * 2 + c * 3 + (double) (d != NULL) + e * 5 + f * 6 + g * 7
+    + h * 8 + i * 9 + j * 10 + k * 11 + l * 12 + m * 13 + n * 14;
+}
+
 static signed char ret_sc(signed char x)
 {
   return (signed char) (x + 1);
@@ -68,6 +79,48 @@ int main (void)
     ffi_call_plan_free(plan);
   }
 
+  /* Every argument register in use, in interleaved order.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[14];
+    void *values[14];
+    ffi_call_plan *plan;
+    short a = -3;
+    double b = 0.5, e = -1.25, i = 8.0, j = -0.125, n = 3.75, rc, rp;
+    float c = 1.5f, g = -2.5f, l = 0.25f;
+    void *d = &cif;
+    int f = -100000;
+    long h = 1L << 40;
+    signed char k = -7;
+    unsigned m = 4000000000u;
+
+    args[0] = &ffi_type_sshort;   values[0] = &a;
+    args[1] = &ffi_type_double;   values[1] = &b;
+    args[2] = &ffi_type_float;    values[2] = &c;
+    args[3] = &ffi_type_pointer;  values[3] = &d;
+    args[4] = &ffi_type_double;   values[4] = &e;
+    args[5] = &ffi_type_sint;     values[5] = &f;
+    args[6] = &ffi_type_float;    values[6] = &g;
+    args[7] = &ffi_type_slong;    values[7] = &h;
+    args[8] = &ffi_type_double;   values[8] = &i;
+    args[9] = &ffi_type_double;   values[9] = &j;
+    args[10] = &ffi_type_schar;   values[10] = &k;
+    args[11] = &ffi_type_float;   values[11] = &l;
+    args[12] = &ffi_type_uint;    values[12] = &m;
+    args[13] = &ffi_type_double;  values[13] = &n;
+
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 14, &ffi_type_double, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(full), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(full), &rp, values);
+    CHECK_DOUBLE_EQ(rc, rp);
+    CHECK_DOUBLE_EQ(rp, full(a, b, c, d, e, f, g, h, i, j, k, l, m, n));
+    ffi_call_plan_free(plan);
+  }
+
   /* Float arguments and float return. */
   {
     ffi_cif cif;
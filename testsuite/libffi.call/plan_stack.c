@@ -0,0 +1,208 @@
+/* Area:	ffi_call_plan
+   Purpose:	Check that a reusable call plan reproduces ffi_call for
+		signatures with stack arguments: spilled integers and
+		doubles, a struct passed in memory, an in-memory struct
+		return and a register-pair return, including discarded
+		results.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_call_plan tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+struct big3 { double a, b, c; };
+struct ld { long h; double w; };
+
+static long spill_l(long a, long b, long c, long d, long e, long f,
+		    char g, short h, int i, long j)
+{
+  return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6
+    + g * 7 + h * 8 + (long) i * 9 + j * 10;
+}
+
+static double spill_d(double a, double b, double c, double d, double e,
+		      double f, double g, double h, float i, double j,
+		      int k)
+{
+  return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8
+    + i * 9 + j * 10 + k;
+}
+
+/* The struct is larger than two eightbytes: always passed in memory.  */
+static struct big3 scale_big3(struct big3 s, double k, long n)
+{
+  struct big3 r;
+  r.a = s.a * k;
+  r.b = s.b * k + n;
+  r.c = s.c - n;
+  return r;
+}
+
+static struct ld pair_spill(long a, long b, long c, long d, long e, long f,
+			    long g, double w)
+{
+  struct ld r;
+  r.h = a + b + c + d + e + f + g;
+  r.w = w * g;
+  return r;
+}
+
+static ffi_type *
+make_struct (ffi_type *t, ffi_type **elts, ffi_type *e0, ffi_type *e1,
+	     ffi_type *e2)
+{
+  elts[0] = e0;
+  elts[1] = e1;
+  elts[2] = e2;
+  elts[3] = NULL;
+  t->size = t->alignment = 0;
+  t->type = FFI_TYPE_STRUCT;
+  t->elements = elts;
+  return t;
+}
+
+int main (void)
+{
+  ffi_type big3_t, ld_t;
+  ffi_type *big3_e[4], *ld_e[4];
+
+  make_struct (&big3_t, big3_e, &ffi_type_double, &ffi_type_double,
+	       &ffi_type_double);
+  make_struct (&ld_t, ld_e, &ffi_type_slong, &ffi_type_double, NULL);
+
+  /* Four narrow and wide integers after the six GPRs.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[10];
+    void *values[10];
+    ffi_call_plan *plan;
+    long v[6];
+    char g = -7;
+    short h = 300;
+    int i = -100000;
+    long j = 1L << 40;
+    ffi_arg rc, rp;
+    int k;
+
+    for (k = 0; k < 6; k++)
+      {
+	args[k] = &ffi_type_slong;
+	v[k] = k * 5 - 12;
+	values[k] = &v[k];
+      }
+    args[6] = &ffi_type_schar;  values[6] = &g;
+    args[7] = &ffi_type_sshort; values[7] = &h;
+    args[8] = &ffi_type_sint;   values[8] = &i;
+    args[9] = &ffi_type_slong;  values[9] = &j;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 10, &ffi_type_slong, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    for (k = 0; k < 4; k++)
+      {
+	g = (char) (g + 3);
+	j -= 999;
+	ffi_call(&cif, FFI_FN(spill_l), &rc, values);
+	ffi_call_plan_invoke(plan, FFI_FN(spill_l), &rp, values);
+	CHECK(rc == rp);
+	CHECK((long) rp == spill_l(v[0], v[1], v[2], v[3], v[4], v[5],
+				   g, h, i, j));
+      }
+    ffi_call_plan_invoke(plan, FFI_FN(spill_l), NULL, values);
+    ffi_call_plan_free(plan);
+  }
+
+  /* A float and a double after the eight SSE registers.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[11];
+    void *values[11];
+    ffi_call_plan *plan;
+    double d[8], j = -0.125, rc, rp;
+    float f = 2.5f;
+    int n = 17, k;
+
+    for (k = 0; k < 8; k++)
+      {
+	args[k] = &ffi_type_double;
+	d[k] = k * 0.5 + 0.25;
+	values[k] = &d[k];
+      }
+    args[8] = &ffi_type_float;   values[8] = &f;
+    args[9] = &ffi_type_double;  values[9] = &j;
+    args[10] = &ffi_type_sint;   values[10] = &n;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 11, &ffi_type_double, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(spill_d), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(spill_d), &rp, values);
+    CHECK_DOUBLE_EQ(rc, rp);
+    CHECK_DOUBLE_EQ(rp, spill_d(d[0], d[1], d[2], d[3], d[4], d[5], d[6],
+				d[7], f, j, n));
+    ffi_call_plan_free(plan);
+  }
+
+  /* Memory-class struct argument with an in-memory struct return.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[3];
+    void *values[3];
+    ffi_call_plan *plan;
+    struct big3 s, rc, rp;
+    double k = 1.5;
+    long n = -9;
+
+    s.a = 2.0; s.b = -3.0; s.c = 0.5;
+    args[0] = &big3_t;          values[0] = &s;
+    args[1] = &ffi_type_double; values[1] = &k;
+    args[2] = &ffi_type_slong;  values[2] = &n;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 3, &big3_t, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(scale_big3), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(scale_big3), &rp, values);
+    CHECK_DOUBLE_EQ(rc.a, rp.a);
+    CHECK_DOUBLE_EQ(rc.b, rp.b);
+    CHECK_DOUBLE_EQ(rc.c, rp.c);
+    CHECK_DOUBLE_EQ(rp.b, s.b * k + n);
+    ffi_call_plan_invoke(plan, FFI_FN(scale_big3), NULL, values);
+    ffi_call_plan_free(plan);
+  }
+
+  /* {long,double} returned in rax/xmm0 with one stack argument.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[8];
+    void *values[8];
+    ffi_call_plan *plan;
+    long v[7];
+    double w = 0.75;
+    struct ld rc, rp;
+    int k;
+
+    for (k = 0; k < 7; k++)
+      {
+	args[k] = &ffi_type_slong;
+	v[k] = 100 - k * 7;
+	values[k] = &v[k];
+      }
+    args[7] = &ffi_type_double;  values[7] = &w;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 8, &ld_t, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(pair_spill), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(pair_spill), &rp, values);
+    CHECK(rc.h == rp.h);
+    CHECK_DOUBLE_EQ(rc.w, rp.w);
+    CHECK_DOUBLE_EQ(rp.w, w * v[6]);
+    ffi_call_plan_free(plan);
+  }
+
+  exit(0);
+}
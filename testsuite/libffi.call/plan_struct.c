@@ -1,10 +1,9 @@
 /* Area:	ffi_call_plan
    Purpose:	Check that a reusable call plan reproduces ffi_call for struct
-		returns.  A struct return does not disable planning (only a
-		struct *argument* does), so this drives both the in-memory
-		return path (RET_IN_MEM, including a NULL rvalue) and the
-		register-pair struct return path, plus a large struct argument
-		that forces the ffi_call by-value copy fallback.
+		returns.  This drives both the in-memory return path
+		(RET_IN_MEM, including a NULL rvalue) and the register-pair
+		struct return path, plus a large struct argument that is
+		passed in memory.
    Limitations:	none.
    PR:		none.
    Originator:	ffi_call_plan tests  */
@@ -27,9 +26,8 @@ static struct big3 make_big3(double a, double b, double c)
   return r;
 }
 
-/* A struct larger than 16 bytes passed by value forces ffi_call to make a
-   copy; build_plan has no fast path for a struct argument, so this exercises
-   the plan's fallback to ffi_call. */
+/* A struct larger than 16 bytes passed by value is copied to the stack, so
+   this exercises the plan's stack move for an aggregate. */
 static double sum_big3(struct big3 s)
 {
   return s.a + s.b + s.c;
@@ -107,7 +105,7 @@ int main (void)
     ffi_call_plan_free(plan);
   }
 
-  /* Large struct argument: no fast path, falls back to ffi_call. */
+  /* Large struct argument: passed in memory. */
   {
     ffi_cif cif;
     ffi_type *args[1];
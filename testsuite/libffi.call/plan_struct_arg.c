@@ -0,0 +1,211 @@
+/* Area:	ffi_call_plan
+   Purpose:	Check that a reusable call plan reproduces ffi_call for small
+		struct arguments passed in registers: an all-INTEGER pair,
+		an all-SSE pair, mixed INTEGER/SSE eightbytes, a 12-byte
+		struct with a short trailing eightbyte, and a struct that
+		spills to the stack once the registers run out.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_call_plan tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+struct ll { long a, b; };
+struct dd { double x, y; };
+struct ld { long h; double w; };
+struct fff { float a, b, c; };
+
+static long take_ll(struct ll s, int k)
+{
+  return s.a * k - s.b;
+}
+
+static double take_dd(double scale, struct dd p, struct dd q)
+{
+  return scale * (p.x * q.y - p.y * q.x);
+}
+
+static double take_ld(struct ld s, float f)
+{
+  return (double) s.h + s.w * f;
+}
+
+static float take_fff(struct fff s)
+{
+  return s.a + s.b * 2 + s.c * 3;
+}
+
+/* Five pairs need ten GPRs: the last two pairs go on the stack.  */
+static long take_ll5(struct ll a, struct ll b, struct ll c,
+		     struct ll d, struct ll e)
+{
+  return a.a + a.b * 2 + b.a * 3 + b.b * 4 + c.a * 5 + c.b * 6
+    + d.a * 7 + d.b * 8 + e.a * 9 + e.b * 10;
+}
+
+static ffi_type *
+make_struct (ffi_type *t, ffi_type **elts, ffi_type *e0, ffi_type *e1,
+	     ffi_type *e2)
+{
+  elts[0] = e0;
+  elts[1] = e1;
+  elts[2] = e2;
+  elts[3] = NULL;
+  t->size = t->alignment = 0;
+  t->type = FFI_TYPE_STRUCT;
+  t->elements = elts;
+  return t;
+}
+
+int main (void)
+{
+  ffi_type ll_t, dd_t, ld_t, fff_t;
+  ffi_type *ll_e[4], *dd_e[4], *ld_e[4], *fff_e[4];
+
+  make_struct (&ll_t, ll_e, &ffi_type_slong, &ffi_type_slong, NULL);
+  make_struct (&dd_t, dd_e, &ffi_type_double, &ffi_type_double, NULL);
+  make_struct (&ld_t, ld_e, &ffi_type_slong, &ffi_type_double, NULL);
+  make_struct (&fff_t, fff_e, &ffi_type_float, &ffi_type_float,
+	       &ffi_type_float);
+
+  /* {long,long} plus a sign-extended int.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[2];
+    void *values[2];
+    ffi_call_plan *plan;
+    struct ll s;
+    int k = -3;
+    ffi_arg rc, rp;
+
+    args[0] = &ll_t;
+    args[1] = &ffi_type_sint;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 2, &ffi_type_slong, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    s.a = 1000;
+    s.b = -17;
+    values[0] = &s;
+    values[1] = &k;
+    ffi_call(&cif, FFI_FN(take_ll), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(take_ll), &rp, values);
+    CHECK(rc == rp);
+    CHECK((long) rp == take_ll(s, k));
+    ffi_call_plan_free(plan);
+  }
+
+  /* Two {double,double} pairs after a scalar double.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[3];
+    void *values[3];
+    ffi_call_plan *plan;
+    struct dd p, q;
+    double scale = 0.5, rc, rp;
+
+    args[0] = &ffi_type_double;
+    args[1] = &dd_t;
+    args[2] = &dd_t;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 3, &ffi_type_double, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    p.x = 1.25; p.y = -2.0;
+    q.x = 3.5;  q.y = 4.75;
+    values[0] = &scale;
+    values[1] = &p;
+    values[2] = &q;
+    ffi_call(&cif, FFI_FN(take_dd), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(take_dd), &rp, values);
+    CHECK_DOUBLE_EQ(rc, rp);
+    CHECK_DOUBLE_EQ(rp, take_dd(scale, p, q));
+    ffi_call_plan_free(plan);
+  }
+
+  /* Mixed INTEGER/SSE eightbytes, then a float.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[2];
+    void *values[2];
+    ffi_call_plan *plan;
+    struct ld s;
+    float f = 2.0f;
+    double rc, rp;
+
+    args[0] = &ld_t;
+    args[1] = &ffi_type_float;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 2, &ffi_type_double, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    s.h = 40;
+    s.w = 1.25;
+    values[0] = &s;
+    values[1] = &f;
+    ffi_call(&cif, FFI_FN(take_ld), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(take_ld), &rp, values);
+    CHECK_DOUBLE_EQ(rc, rp);
+    CHECK_DOUBLE_EQ(rp, take_ld(s, f));
+    ffi_call_plan_free(plan);
+  }
+
+  /* 12-byte all-float struct: the second eightbyte is only 4 bytes.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[1];
+    void *values[1];
+    ffi_call_plan *plan;
+    struct fff s;
+    float rc, rp;
+
+    args[0] = &fff_t;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_float, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    s.a = 1.0f; s.b = 2.5f; s.c = -4.0f;
+    values[0] = &s;
+    ffi_call(&cif, FFI_FN(take_fff), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(take_fff), &rp, values);
+    CHECK(rc == rp);
+    CHECK(rp == take_fff(s));
+    ffi_call_plan_free(plan);
+  }
+
+  /* More pairs than there are GPRs: the tail is passed on the stack.  */
+  {
+    ffi_cif cif;
+    ffi_type *args[5];
+    void *values[5];
+    ffi_call_plan *plan;
+    struct ll s[5];
+    ffi_arg rc, rp;
+    int i;
+
+    for (i = 0; i < 5; i++)
+      {
+	args[i] = &ll_t;
+	s[i].a = i * 11 + 1;
+	s[i].b = -(i * 13 + 2);
+	values[i] = &s[i];
+      }
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 5, &ffi_type_slong, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+
+    ffi_call(&cif, FFI_FN(take_ll5), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(take_ll5), &rp, values);
+    CHECK(rc == rp);
+    CHECK((long) rp == take_ll5(s[0], s[1], s[2], s[3], s[4]));
+    ffi_call_plan_free(plan);
+  }
+
+  exit(0);
+}
@@ -0,0 +1,199 @@
+/* Area:	ffi_call_plan
+   Purpose:	Check that a reusable call plan reproduces ffi_call for
+		values returned in register pairs: {double,double},
+		{long,double}, {double,long}, a 12-byte struct whose tail
+		must not be overwritten past its size, and long double,
+		including a discarded long double result.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_call_plan tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+struct dd { double x, y; };
+struct ld { long h; double w; };
+struct dl { double w; long h; };
+struct iii { int a, b, c; };
+
+static int call_count = 0;
+
+static struct dd make_dd(double x, double y)
+{
+  struct dd r;
+  r.x = x * 2;
+  r.y = y - 1;
+  return r;
+}
+
+static struct ld make_ld(long h, double w)
+{
+  struct ld r;
+  r.h = h + 1;
+  r.w = w * 3;
+  return r;
+}
+
+static struct dl make_dl(long h, double w)
+{
+  struct dl r;
+  r.w = w / 2;
+  r.h = h - 5;
+  return r;
+}
+
+static struct iii make_iii(int a)
+{
+  struct iii r;
+  r.a = a;
+  r.b = a * 2;
+  r.c = a * 3;
+  return r;
+}
+
+static long double ld_scale(double x, int k)
+{
+  call_count++;
+  return (long double) x * k;
+}
+
+static ffi_type *
+make_struct (ffi_type *t, ffi_type **elts, ffi_type *e0, ffi_type *e1,
+	     ffi_type *e2)
+{
+  elts[0] = e0;
+  elts[1] = e1;
+  elts[2] = e2;
+  elts[3] = NULL;
+  t->size = t->alignment = 0;
+  t->type = FFI_TYPE_STRUCT;
+  t->elements = elts;
+  return t;
+}
+
+int main (void)
+{
+  ffi_type dd_t, ld_t, dl_t, iii_t;
+  ffi_type *dd_e[4], *ld_e[4], *dl_e[4], *iii_e[4];
+  ffi_type *args[2];
+  void *values[2];
+  ffi_cif cif;
+  ffi_call_plan *plan;
+  long h = 41;
+  double w = 2.5;
+
+  make_struct (&dd_t, dd_e, &ffi_type_double, &ffi_type_double, NULL);
+  make_struct (&ld_t, ld_e, &ffi_type_slong, &ffi_type_double, NULL);
+  make_struct (&dl_t, dl_e, &ffi_type_double, &ffi_type_slong, NULL);
+  make_struct (&iii_t, iii_e, &ffi_type_sint, &ffi_type_sint,
+	       &ffi_type_sint);
+
+  /* {double,double}: both halves in SSE registers.  */
+  {
+    double x = 1.5, y = -4.0;
+    struct dd rc, rp;
+
+    args[0] = &ffi_type_double;
+    args[1] = &ffi_type_double;
+    values[0] = &x;
+    values[1] = &y;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 2, &dd_t, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+    ffi_call(&cif, FFI_FN(make_dd), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(make_dd), &rp, values);
+    CHECK_DOUBLE_EQ(rc.x, rp.x);
+    CHECK_DOUBLE_EQ(rc.y, rp.y);
+    CHECK_DOUBLE_EQ(rp.x, x * 2);
+    CHECK_DOUBLE_EQ(rp.y, y - 1);
+    ffi_call_plan_free(plan);
+  }
+
+  args[0] = &ffi_type_slong;
+  args[1] = &ffi_type_double;
+  values[0] = &h;
+  values[1] = &w;
+
+  /* {long,double}: INTEGER then SSE.  */
+  {
+    struct ld rc, rp;
+
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 2, &ld_t, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+    ffi_call(&cif, FFI_FN(make_ld), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(make_ld), &rp, values);
+    CHECK(rc.h == rp.h);
+    CHECK_DOUBLE_EQ(rc.w, rp.w);
+    CHECK(rp.h == h + 1);
+    CHECK_DOUBLE_EQ(rp.w, w * 3);
+    ffi_call_plan_free(plan);
+  }
+
+  /* {double,long}: SSE then INTEGER.  */
+  {
+    struct dl rc, rp;
+
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 2, &dl_t, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+    ffi_call(&cif, FFI_FN(make_dl), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(make_dl), &rp, values);
+    CHECK(rc.h == rp.h);
+    CHECK_DOUBLE_EQ(rc.w, rp.w);
+    CHECK(rp.h == h - 5);
+    CHECK_DOUBLE_EQ(rp.w, w / 2);
+    ffi_call_plan_free(plan);
+  }
+
+  /* 12-byte struct: only 12 bytes of rvalue may be written.  */
+  {
+    int a = 7;
+    struct { struct iii s; int guard; } rc, rp;
+
+    args[0] = &ffi_type_sint;
+    values[0] = &a;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &iii_t, args) == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+    rc.guard = rp.guard = 0x5a5a5a5a;
+    ffi_call(&cif, FFI_FN(make_iii), &rc.s, values);
+    ffi_call_plan_invoke(plan, FFI_FN(make_iii), &rp.s, values);
+    CHECK(rc.s.a == rp.s.a && rc.s.b == rp.s.b && rc.s.c == rp.s.c);
+    CHECK(rp.s.c == a * 3);
+    CHECK(rp.guard == 0x5a5a5a5a);
+    ffi_call_plan_free(plan);
+  }
+
+  /* long double: x87 st(0) on most x86-64 targets.  */
+  {
+    double x = 1.25;
+    long double rc, rp;
+    int k = -3, i, before;
+
+    args[0] = &ffi_type_double;
+    args[1] = &ffi_type_sint;
+    values[0] = &x;
+    values[1] = &k;
+    CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 2, &ffi_type_longdouble, args)
+	  == FFI_OK);
+    plan = ffi_call_plan_alloc(&cif);
+    CHECK(plan != NULL);
+    ffi_call(&cif, FFI_FN(ld_scale), &rc, values);
+    ffi_call_plan_invoke(plan, FFI_FN(ld_scale), &rp, values);
+    CHECK(rc == rp);
+    CHECK(rp == (long double) x * k);
+
+    /* A discarded result must still be popped; repeat enough times to
+       overflow the eight-entry x87 stack if it were not.  */
+    before = call_count;
+    for (i = 0; i < 16; i++)
+      ffi_call_plan_invoke(plan, FFI_FN(ld_scale), NULL, values);
+    CHECK(call_count == before + 16);
+    ffi_call_plan_invoke(plan, FFI_FN(ld_scale), &rp, values);
+    CHECK(rp == (long double) x * k);
+    ffi_call_plan_free(plan);
+  }
+
+  exit(0);
+}
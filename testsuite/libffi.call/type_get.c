@@ -0,0 +1,129 @@
+/* Area:	ffi_type_struct_get, ffi_type_array_get, ffi_type_vector_get
+   Purpose:	Check that canonical types are laid out like the C types
+		they describe, that structurally identical descriptions give
+		the same pointer, that different layouts do not, that
+		malformed types and impossible counts are refused, and that
+		a canonical struct can be passed and returned.
+   Limitations:	none.
+   PR:		none.
+   Originator:	canonical type tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+#include <stddef.h>
+
+struct inner { char c; double d; };
+struct outer { int i; struct inner in; short s; };
+
+static struct outer
+bump (struct outer o, int k)
+{
+  o.i += k;
+  o.in.c = (char) (o.in.c + k);
+  o.in.d *= k;
+  o.s = (short) (o.s - k);
+  return o;
+}
+
+int main (void)
+{
+  ffi_type *inner_e[2], *outer_e[3], *args[2];
+  ffi_type *inner_t, *outer_t, *t;
+  ffi_type hand_t;
+  ffi_type *hand_e[3];
+  size_t offsets[3];
+  ffi_cif cif;
+
+  inner_e[0] = &ffi_type_schar;
+  inner_e[1] = &ffi_type_double;
+  inner_t = ffi_type_struct_get(inner_e, 2);
+  CHECK(inner_t != NULL);
+  CHECK(inner_t->type == FFI_TYPE_STRUCT);
+  CHECK(inner_t->size == sizeof(struct inner));
+  CHECK(inner_t->alignment
+	== offsetof(struct { char c; struct inner x; }, x));
+  CHECK(inner_t->elements[2] == NULL);
+
+  /* Same members from another array, and through another name for the
+     same scalar: the same type.  */
+  inner_e[0] = &ffi_type_sint8;
+  CHECK(ffi_type_struct_get(inner_e, 2) == inner_t);
+
+  /* A hand-built member is replaced by its canonical form.  */
+  hand_e[0] = &ffi_type_sint8;
+  hand_e[1] = &ffi_type_double;
+  hand_e[2] = NULL;
+  hand_t.size = hand_t.alignment = 0;
+  hand_t.type = FFI_TYPE_STRUCT;
+  hand_t.elements = hand_e;
+  outer_e[0] = &ffi_type_sint;
+  outer_e[1] = &hand_t;
+  outer_e[2] = &ffi_type_sshort;
+  outer_t = ffi_type_struct_get(outer_e, 3);
+  CHECK(outer_t != NULL && outer_t->elements[1] == inner_t);
+  outer_e[1] = inner_t;
+  CHECK(ffi_type_struct_get(outer_e, 3) == outer_t);
+  CHECK(outer_t->size == sizeof(struct outer));
+  CHECK(ffi_get_struct_offsets(FFI_DEFAULT_ABI, outer_t, offsets) == FFI_OK);
+  CHECK(offsets[1] == offsetof(struct outer, in));
+  CHECK(offsets[2] == offsetof(struct outer, s));
+
+  /* Different layouts are different types.  */
+  outer_e[2] = &ffi_type_ushort;
+  CHECK(ffi_type_struct_get(outer_e, 3) != outer_t);
+  CHECK(ffi_type_struct_get(outer_e, 2) != outer_t);
+
+  /* An array is a struct of identical members.  */
+  t = ffi_type_array_get(&ffi_type_float, 3);
+  CHECK(t != NULL && t->size == 3 * sizeof(float));
+  inner_e[0] = inner_e[1] = &ffi_type_float;
+  CHECK(ffi_type_array_get(&ffi_type_float, 2)
+	== ffi_type_struct_get(inner_e, 2));
+  CHECK(ffi_type_array_get(&ffi_type_float, 2) != t);
+  CHECK(ffi_type_array_get(inner_t, 4)->size == 4 * sizeof(struct inner));
+
+  /* Vectors round up to a power of two.  */
+  t = ffi_type_vector_get(&ffi_type_float, 3);
+  CHECK(t != NULL && t->type == FFI_TYPE_VECTOR && t->size == 16);
+  CHECK(ffi_type_vector_get(&ffi_type_float, 3) == t);
+  CHECK(ffi_type_vector_get(&ffi_type_float, 3)
+	!= ffi_type_array_get(&ffi_type_float, 3));
+
+  /* Malformed types.  */
+  inner_e[0] = &ffi_type_void;
+  CHECK(ffi_type_struct_get(inner_e, 2) == NULL);
+  CHECK(ffi_type_array_get(&ffi_type_sint, 0) == NULL);
+  CHECK(ffi_type_vector_get(inner_t, 2) == NULL);
+
+  /* Counts whose element arrays cannot be allocated, including ones
+     whose byte size would wrap around to something small.  */
+  CHECK(ffi_type_array_get(&ffi_type_uint8, SIZE_MAX / 4) == NULL);
+  CHECK(ffi_type_array_get(&ffi_type_uint8,
+			   SIZE_MAX / sizeof(ffi_type *) + 2) == NULL);
+  CHECK(ffi_type_vector_get(&ffi_type_float,
+			    SIZE_MAX / sizeof(ffi_type *) + 2) == NULL);
+  CHECK(ffi_type_struct_get(inner_e, SIZE_MAX / sizeof(ffi_type *) + 2)
+	== NULL);
+
+  /* Pass and return a canonical struct.  */
+  args[0] = outer_t;
+  args[1] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 2, outer_t, args) == FFI_OK);
+  {
+    struct outer o, r;
+    int k = 3;
+    void *values[2];
+
+    o.i = 10;
+    o.in.c = 'a';
+    o.in.d = 1.5;
+    o.s = 100;
+    values[0] = &o;
+    values[1] = &k;
+    ffi_call(&cif, FFI_FN(bump), &r, values);
+    CHECK(r.i == 13 && r.in.c == 'd' && r.s == 97);
+    CHECK_DOUBLE_EQ(r.in.d, 4.5);
+  }
+
+  exit(0);
+}
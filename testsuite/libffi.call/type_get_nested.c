@@ -0,0 +1,168 @@
+/* Area:	ffi_type_struct_get, ffi_call
+   Purpose:	Check that canonical struct types pass and return correctly
+		when the same type is used again and again: a three-level
+		nested struct, a struct passed in memory and structs that
+		travel in a general and a vector register.  A hand-built
+		type laid out like a canonical one, its elements right
+		after it, is not mistaken for one when it changes.
+   Limitations:	none.
+   PR:		none.
+   Originator:	canonical type tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+struct s1 { char a; float b; };
+struct s2 { struct s1 x; short y; };
+struct s3 { struct s2 p; double q; };
+struct big { long a, b, c; };
+struct ffl { float x, y; long z; };
+
+static struct s3
+nest (struct s3 s, int k)
+{
+  s.p.x.a = (char) (s.p.x.a + k);
+  s.p.x.b *= k;
+  s.p.y = (short) (s.p.y - k);
+  s.q += k;
+  return s;
+}
+
+static long
+sum_big (struct big b, struct s1 m)
+{
+  return b.a + b.b * 2 + b.c * 3 + m.a + (long) m.b;
+}
+
+static struct ffl
+swap (struct ffl w)
+{
+  float t = w.x;
+
+  w.x = w.y;
+  w.y = t;
+  w.z = -w.z;
+  return w;
+}
+
+int main (void)
+{
+  ffi_type *e[3], *nest_args[2], *big_args[2], *ffl_args[1];
+  ffi_type *s1_t, *s2_t, *s3_t, *big_t, *ffl_t;
+  ffi_cif nest_cif, big_cif, ffl_cif;
+  struct { ffi_type t; ffi_type *e[4]; } hand;
+  int i;
+
+  e[0] = &ffi_type_schar;
+  e[1] = &ffi_type_float;
+  s1_t = ffi_type_struct_get(e, 2);
+  e[0] = s1_t;
+  e[1] = &ffi_type_sshort;
+  s2_t = ffi_type_struct_get(e, 2);
+  e[0] = s2_t;
+  e[1] = &ffi_type_double;
+  s3_t = ffi_type_struct_get(e, 2);
+  big_t = ffi_type_array_get(&ffi_type_slong, 3);
+  e[0] = e[1] = &ffi_type_float;
+  e[2] = &ffi_type_slong;
+  ffl_t = ffi_type_struct_get(e, 3);
+  CHECK(s1_t && s2_t && s3_t && big_t && ffl_t);
+  CHECK(s3_t->size == sizeof(struct s3));
+
+  nest_args[0] = s3_t;
+  nest_args[1] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&nest_cif, FFI_DEFAULT_ABI, 2, s3_t, nest_args)
+	== FFI_OK);
+  big_args[0] = big_t;
+  big_args[1] = s1_t;
+  CHECK(ffi_prep_cif(&big_cif, FFI_DEFAULT_ABI, 2, &ffi_type_slong, big_args)
+	== FFI_OK);
+  ffl_args[0] = ffl_t;
+  CHECK(ffi_prep_cif(&ffl_cif, FFI_DEFAULT_ABI, 1, ffl_t, ffl_args)
+	== FFI_OK);
+
+  for (i = 0; i < 4; i++)
+    {
+      struct s3 s, r;
+      struct big b;
+      struct s1 m;
+      struct ffl w, wr;
+      ffi_arg lr;
+      int k = i + 2;
+      void *values[2];
+
+      s.p.x.a = 'A';
+      s.p.x.b = 1.5f;
+      s.p.y = 1000;
+      s.q = -0.25;
+      values[0] = &s;
+      values[1] = &k;
+      ffi_call(&nest_cif, FFI_FN(nest), &r, values);
+      CHECK(r.p.x.a == 'A' + k && r.p.y == 1000 - k);
+      CHECK(r.p.x.b == 1.5f * k);
+      CHECK_DOUBLE_EQ(r.q, -0.25 + k);
+
+      b.a = i;
+      b.b = -7;
+      b.c = 100;
+      m.a = 3;
+      m.b = 4.0f;
+      values[0] = &b;
+      values[1] = &m;
+      ffi_call(&big_cif, FFI_FN(sum_big), &lr, values);
+      CHECK((long) lr == sum_big(b, m));
+
+      w.x = 0.5f * k;
+      w.y = -2.0f;
+      w.z = (long) k * 100000 + 7;
+      values[0] = &w;
+      ffi_call(&ffl_cif, FFI_FN(swap), &wr, values);
+      CHECK(wr.x == -2.0f && wr.y == 0.5f * k && wr.z == -w.z);
+    }
+
+  /* The same storage describes struct ffl, then struct big.  */
+  hand.t.size = hand.t.alignment = 0;
+  hand.t.type = FFI_TYPE_STRUCT;
+  hand.t.elements = hand.e;
+  hand.e[0] = hand.e[1] = &ffi_type_float;
+  hand.e[2] = &ffi_type_slong;
+  hand.e[3] = NULL;
+  ffl_args[0] = &hand.t;
+  CHECK(ffi_prep_cif(&ffl_cif, FFI_DEFAULT_ABI, 1, &hand.t, ffl_args)
+	== FFI_OK);
+  {
+    struct ffl w, wr;
+    void *values[1];
+
+    w.x = 1.0f;
+    w.y = 2.0f;
+    w.z = 3;
+    values[0] = &w;
+    ffi_call(&ffl_cif, FFI_FN(swap), &wr, values);
+    CHECK(wr.x == 2.0f && wr.y == 1.0f && wr.z == -3);
+  }
+
+  hand.t.size = hand.t.alignment = 0;
+  hand.e[0] = hand.e[1] = &ffi_type_slong;
+  big_args[0] = &hand.t;
+  CHECK(ffi_prep_cif(&big_cif, FFI_DEFAULT_ABI, 2, &ffi_type_slong, big_args)
+	== FFI_OK);
+  {
+    struct big b;
+    struct s1 m;
+    ffi_arg lr;
+    void *values[2];
+
+    b.a = 11;
+    b.b = 22;
+    b.c = 33;
+    m.a = 1;
+    m.b = 2.0f;
+    values[0] = &b;
+    values[1] = &m;
+    ffi_call(&big_cif, FFI_FN(sum_big), &lr, values);
+    CHECK((long) lr == sum_big(b, m));
+  }
+
+  exit(0);
+}
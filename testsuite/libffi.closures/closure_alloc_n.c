@@ -0,0 +1,66 @@
+/* Area:	ffi_closure_alloc_n, ffi_closure_free_n
+   Purpose:	Check that closures allocated in bulk are distinct, callable
+		and independently preparable, that they can be freed in bulk
+		or one at a time, and that an empty batch succeeds.
+   Limitations:	none.
+   PR:		none.
+   Originator:	closure allocation tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define N 5000
+
+typedef int (*closure_test_type)(int);
+
+static void
+closure_test_fn (ffi_cif *cif __UNUSED__, void *resp, void **args,
+		 void *userdata)
+{
+  *(ffi_arg *)resp = *(int *)args[0] * 2 + (int)(intptr_t)userdata;
+}
+
+int main (void)
+{
+  static void *closures[N], *code[N];
+  ffi_cif cif;
+  ffi_type *args[1];
+  int i;
+
+  args[0] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  CHECK(ffi_closure_alloc_n(sizeof(ffi_closure), 0, closures, code));
+
+  CHECK(ffi_closure_alloc_n(sizeof(ffi_closure), N, closures, code));
+  for (i = 0; i < N; i++)
+    {
+      CHECK(closures[i] != NULL && code[i] != NULL);
+      CHECK(i == 0 || code[i] != code[i - 1]);
+      CHECK(ffi_prep_closure_loc(closures[i], &cif, closure_test_fn,
+				 (void *)(intptr_t)i, code[i]) == FFI_OK);
+    }
+  for (i = 0; i < N; i++)
+    CHECK(((closure_test_type)code[i])(7) == 14 + i);
+
+  /* Every other closure on its own, the rest in one call.  */
+  for (i = 0; i < N; i += 2)
+    ffi_closure_free(closures[i]);
+  for (i = 1; i < N; i += 2)
+    CHECK(((closure_test_type)code[i])(-1) == i - 2);
+  for (i = 0; i < N / 2; i++)
+    closures[i] = closures[2 * i + 1];
+  ffi_closure_free_n(closures, N / 2);
+
+  /* The released memory and trampolines can be handed out again.  */
+  CHECK(ffi_closure_alloc_n(sizeof(ffi_closure), N, closures, code));
+  for (i = 0; i < N; i++)
+    CHECK(ffi_prep_closure_loc(closures[i], &cif, closure_test_fn,
+			       (void *)(intptr_t)-i, code[i]) == FFI_OK);
+  for (i = 0; i < N; i++)
+    CHECK(((closure_test_type)code[i])(i) == i);
+  ffi_closure_free_n(closures, N);
+
+  exit(0);
+}
@@ -0,0 +1,85 @@
+/* Area:	ffi_closure_alloc, static trampolines
+   Purpose:	Check that small closures and large ones, which come from
+		different allocators when static trampolines are in use,
+		can be interleaved, called and freed in any order, and that
+		no temporary executable file is needed for them.
+   Limitations:	none.
+   PR:		none.
+   Originator:	closure allocation tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define N 1500
+
+static void
+closure_test_fn (ffi_cif *cif __UNUSED__, void *resp, void **args,
+		 void *userdata)
+{
+  *(ffi_arg *)resp = *(int *)args[0] + (int)(intptr_t)userdata;
+}
+
+int main (void)
+{
+  static void *closures[N], *code[N];
+  struct ffi_tramp_stats ts;
+  struct ffi_closure_heap_stats hs;
+  ffi_cif cif;
+  ffi_type *args[1];
+  int i;
+
+  args[0] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  /* Every third closure is too big for the small-closure paths.  */
+  for (i = 0; i < N; i++)
+    {
+      size_t size = i % 3 == 2 ? 4096 : sizeof(ffi_closure);
+
+      closures[i] = ffi_closure_alloc(size, &code[i]);
+      CHECK(closures[i] != NULL);
+      CHECK(ffi_prep_closure_loc(closures[i], &cif, closure_test_fn,
+				 (void *)(intptr_t)i, code[i]) == FFI_OK);
+    }
+
+  for (i = 0; i < N; i++)
+    {
+      int a = 7;
+      void *values[1] = { &a };
+      ffi_arg r = 0;
+
+      ffi_call(&cif, FFI_FN(code[i]), &r, values);
+      CHECK((int) r == 7 + i);
+    }
+
+  if (ffi_tramp_stats(&ts) && ffi_closure_heap_stats(&hs))
+    {
+      CHECK(ts.used_tramps >= N);
+      CHECK(hs.exec_file_bytes == 0);
+      CHECK(hs.live_closures == N);
+    }
+
+  /* Free the odd ones by writable address and reallocate them.  */
+  for (i = 1; i < N; i += 2)
+    ffi_closure_free(closures[i]);
+  for (i = 1; i < N; i += 2)
+    {
+      closures[i] = ffi_closure_alloc(sizeof(ffi_closure), &code[i]);
+      CHECK(closures[i] != NULL);
+      CHECK(ffi_prep_closure_loc(closures[i], &cif, closure_test_fn,
+				 (void *)(intptr_t)-i, code[i]) == FFI_OK);
+    }
+  for (i = 0; i < N; i++)
+    {
+      int a = 1;
+      void *values[1] = { &a };
+      ffi_arg r = 0;
+
+      ffi_call(&cif, FFI_FN(code[i]), &r, values);
+      CHECK((int) r == 1 + (i % 2 ? -i : i));
+    }
+
+  ffi_closure_free_n(closures, N);
+  exit(0);
+}
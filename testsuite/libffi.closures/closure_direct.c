@@ -0,0 +1,111 @@
+/* Area:	closure_call, ffi_direct_closure
+   Purpose:	Check that a direct closure's handler can read every
+		argument in place: integers and doubles in registers, a
+		struct split across a general and a vector register, stack
+		arguments, and an in-memory struct return.
+   Limitations:	Only targets that define FFI_DIRECT_CLOSURES.
+   PR:		none.
+   Originator:	ffi_closure_plan tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#ifdef FFI_DIRECT_CLOSURES
+
+struct ld { long h; double w; };
+struct big { long a, b, c; };
+
+static ffi_cif cif;
+
+static void
+direct_fn (ffi_cif *c, void *resp, char *regs, const ffi_direct_loc *loc,
+	   void *userdata)
+{
+  long a = FFI_DIRECT_ARG (long, regs, loc, 0);
+  double b = FFI_DIRECT_ARG (double, regs, loc, 1);
+  struct ld s;
+  int e = FFI_DIRECT_ARG (int, regs, loc, 3);
+  long f = FFI_DIRECT_ARG (long, regs, loc, 4);
+  long g = FFI_DIRECT_ARG (long, regs, loc, 5);
+  long h = FFI_DIRECT_ARG (long, regs, loc, 6);
+  long m = FFI_DIRECT_ARG (long, regs, loc, 7);
+  float k = FFI_DIRECT_ARG (float, regs, loc, 8);
+  struct big *r = resp;
+
+  /* The struct's eightbytes are in different register files.  */
+  memcpy (&s.h, regs + loc[2].lo, 8);
+  memcpy (&s.w, regs + loc[2].hi, 8);
+
+  CHECK(c == &cif);
+  r->a = a + s.h + e + f + g + h + m + (long) (intptr_t) userdata;
+  r->b = (long) (b * 4 + s.w * 2);
+  r->c = (long) (k * 8);
+}
+
+typedef struct big (*direct_type) (long, double, struct ld, int, long, long,
+				   long, long, float);
+
+int main (void)
+{
+  ffi_type ld_t, big_t;
+  ffi_type *ld_e[3], *big_e[4];
+  ffi_type *args[9];
+  ffi_closure_plan *plan;
+  ffi_direct_closure *pcl;
+  void *code;
+  struct ld s = { 100, 0.25 };
+  struct big r;
+  int i;
+
+  ld_e[0] = &ffi_type_slong;
+  ld_e[1] = &ffi_type_double;
+  ld_e[2] = NULL;
+  ld_t.size = ld_t.alignment = 0;
+  ld_t.type = FFI_TYPE_STRUCT;
+  ld_t.elements = ld_e;
+  big_e[0] = big_e[1] = big_e[2] = &ffi_type_slong;
+  big_e[3] = NULL;
+  big_t.size = big_t.alignment = 0;
+  big_t.type = FFI_TYPE_STRUCT;
+  big_t.elements = big_e;
+
+  args[0] = &ffi_type_slong;
+  args[1] = &ffi_type_double;
+  args[2] = &ld_t;
+  args[3] = &ffi_type_sint;
+  args[4] = &ffi_type_slong;
+  args[5] = &ffi_type_slong;
+  args[6] = &ffi_type_slong;
+  args[7] = &ffi_type_slong;
+  args[8] = &ffi_type_float;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 9, &big_t, args) == FFI_OK);
+
+  plan = ffi_closure_plan_alloc(&cif);
+  CHECK(plan != NULL);
+  pcl = ffi_closure_alloc(sizeof(ffi_direct_closure), &code);
+  CHECK(pcl != NULL);
+  CHECK(ffi_prep_direct_closure_loc(pcl, plan, direct_fn, (void *) 7, code)
+	== FFI_OK);
+
+  for (i = 0; i < 3; i++)
+    {
+      /* With the hidden return pointer, M is the first stack argument.  */
+      r = ((direct_type) code) (1, 2.0, s, -3, 40, 500, 6000, 70000, 0.5f);
+      CHECK(r.a == 1 + 100 - 3 + 40 + 500 + 6000 + 70000 + 7);
+      CHECK(r.b == (long) (2.0 * 4 + 0.25 * 2));
+      CHECK(r.c == 4);
+    }
+
+  ffi_closure_free(pcl);
+  ffi_closure_plan_free(plan);
+  exit(0);
+}
+
+#else
+
+int main (void)
+{
+  exit(0);
+}
+
+#endif
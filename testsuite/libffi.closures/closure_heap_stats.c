@@ -0,0 +1,99 @@
+/* Area:	ffi_closure_heap_stats, ffi_closure_heap_trim
+   Purpose:	Check that the closure heap statistics track closures
+		allocated one at a time and in bulk, and that trimming
+		after everything is freed does not grow the heap and
+		leaves it usable.
+   Limitations:	Platforms without a closure heap report nothing.
+   PR:		none.
+   Originator:	closure allocation tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define N 3000
+
+static void
+closure_test_fn (ffi_cif *cif __UNUSED__, void *resp, void **args,
+		 void *userdata __UNUSED__)
+{
+  *(ffi_arg *)resp = *(int *)args[0] + 1;
+}
+
+int main (void)
+{
+  static void *closures[N], *code[N];
+  struct ffi_closure_heap_stats st;
+  ffi_cif cif;
+  ffi_type *args[1];
+  size_t footprint;
+  int i;
+
+  args[0] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  if (!ffi_closure_heap_stats(&st))
+    {
+      CHECK(st.footprint == 0 && st.live_closures == 0);
+      exit(0);
+    }
+
+  for (i = 0; i < N / 2; i++)
+    {
+      closures[i] = ffi_closure_alloc(sizeof(ffi_closure), &code[i]);
+      CHECK(closures[i] != NULL);
+      CHECK(ffi_prep_closure_loc(closures[i], &cif, closure_test_fn, NULL,
+				 code[i]) == FFI_OK);
+    }
+  CHECK(ffi_closure_alloc_n(sizeof(ffi_closure), N - N / 2,
+			    closures + N / 2, code + N / 2));
+
+  CHECK(ffi_closure_heap_stats(&st));
+  CHECK(st.live_closures == N);
+  CHECK(st.footprint > 0);
+  CHECK(st.max_footprint >= st.footprint);
+  CHECK(st.segments >= 1);
+
+  {
+    int a = 41;
+    void *values[1] = { &a };
+    ffi_arg r = 0;
+
+    ffi_call(&cif, FFI_FN(code[0]), &r, values);
+    CHECK((int) r == 42);
+  }
+
+  ffi_closure_free_n(closures + N / 2, N - N / 2);
+  for (i = 0; i < N / 2; i++)
+    ffi_closure_free(closures[i]);
+
+  CHECK(ffi_closure_heap_stats(&st));
+  CHECK(st.live_closures == 0);
+  footprint = st.footprint;
+
+  ffi_closure_heap_trim(0);
+  CHECK(ffi_closure_heap_stats(&st));
+  CHECK(st.live_closures == 0);
+  CHECK(st.cached_closures == 0);
+  CHECK(st.footprint <= footprint);
+  CHECK(st.max_footprint >= footprint);
+
+  /* The heap must still hand out working closures after a trim.  */
+  closures[0] = ffi_closure_alloc(sizeof(ffi_closure), &code[0]);
+  CHECK(closures[0] != NULL);
+  CHECK(ffi_prep_closure_loc(closures[0], &cif, closure_test_fn, NULL,
+			     code[0]) == FFI_OK);
+  {
+    int a = 6;
+    void *values[1] = { &a };
+    ffi_arg r = 0;
+
+    ffi_call(&cif, FFI_FN(code[0]), &r, values);
+    CHECK((int) r == 7);
+  }
+  CHECK(ffi_closure_heap_stats(&st));
+  CHECK(st.live_closures == 1);
+  ffi_closure_free(closures[0]);
+
+  exit(0);
+}
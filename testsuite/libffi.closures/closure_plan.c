@@ -0,0 +1,113 @@
+/* Area:	closure_call, ffi_closure_plan
+   Purpose:	Check closures prepared from a closure plan: integer and
+		floating-point registers, a mixed INTEGER/SSE struct, an
+		SSE pair, stack arguments, an in-memory struct return, and
+		two closures sharing one plan.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_closure_plan tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+struct ld { long h; double w; };
+struct dd { double x, y; };
+struct big { long a, b, c; };
+
+static ffi_cif cif;
+
+static void
+plan_fn (ffi_cif *c, void *resp, void **args, void *userdata)
+{
+  long a = *(long *) args[0];
+  double b = *(double *) args[1];
+  struct ld s = *(struct ld *) args[2];
+  struct dd p = *(struct dd *) args[3];
+  int e = *(int *) args[4];
+  long f = *(long *) args[5];
+  long g = *(long *) args[6];
+  long h = *(long *) args[7];
+  float k = *(float *) args[8];
+  struct big *r = resp;
+
+  CHECK(c == &cif);
+  r->a = a + s.h + e + f + g + h + (long) (intptr_t) userdata;
+  r->b = (long) (b * 4 + s.w * 2 + p.x - p.y);
+  r->c = (long) (k * 8);
+}
+
+typedef struct big (*plan_type) (long, double, struct ld, struct dd, int,
+				 long, long, long, float);
+
+static ffi_type *
+make_struct (ffi_type *t, ffi_type **elts, ffi_type *e0, ffi_type *e1,
+	     ffi_type *e2)
+{
+  elts[0] = e0;
+  elts[1] = e1;
+  elts[2] = e2;
+  elts[3] = NULL;
+  t->size = t->alignment = 0;
+  t->type = FFI_TYPE_STRUCT;
+  t->elements = elts;
+  return t;
+}
+
+int main (void)
+{
+  ffi_type ld_t, dd_t, big_t;
+  ffi_type *ld_e[4], *dd_e[4], *big_e[4];
+  ffi_type *args[9];
+  ffi_closure_plan *plan;
+  ffi_closure *pcl1, *pcl2;
+  void *code1, *code2;
+  struct ld s = { 100, 0.25 };
+  struct dd p = { 7.5, 1.5 };
+  struct big r;
+  int i;
+
+  make_struct (&ld_t, ld_e, &ffi_type_slong, &ffi_type_double, NULL);
+  make_struct (&dd_t, dd_e, &ffi_type_double, &ffi_type_double, NULL);
+  make_struct (&big_t, big_e, &ffi_type_slong, &ffi_type_slong,
+	       &ffi_type_slong);
+
+  args[0] = &ffi_type_slong;
+  args[1] = &ffi_type_double;
+  args[2] = &ld_t;
+  args[3] = &dd_t;
+  args[4] = &ffi_type_sint;
+  args[5] = &ffi_type_slong;
+  args[6] = &ffi_type_slong;
+  args[7] = &ffi_type_slong;
+  args[8] = &ffi_type_float;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 9, &big_t, args) == FFI_OK);
+
+  plan = ffi_closure_plan_alloc(&cif);
+  CHECK(plan != NULL);
+
+  pcl1 = ffi_closure_alloc(sizeof(ffi_closure), &code1);
+  pcl2 = ffi_closure_alloc(sizeof(ffi_closure), &code2);
+  CHECK(pcl1 != NULL && pcl2 != NULL);
+  CHECK(ffi_prep_closure_plan_loc(pcl1, plan, plan_fn, (void *) 1, code1)
+	== FFI_OK);
+  CHECK(ffi_prep_closure_plan_loc(pcl2, plan, plan_fn, (void *) 1000, code2)
+	== FFI_OK);
+
+  for (i = 0; i < 3; i++)
+    {
+      r = ((plan_type) code1) (1, 2.0, s, p, -3, 40, 500, 6000, 0.5f);
+      CHECK(r.a == 1 + 100 - 3 + 40 + 500 + 6000 + 1);
+      CHECK(r.b == (long) (2.0 * 4 + 0.25 * 2 + 7.5 - 1.5));
+      CHECK(r.c == 4);
+
+      r = ((plan_type) code2) (-1, 0.5, s, p, 3, 4, 5, 6, 2.0f);
+      CHECK(r.a == -1 + 100 + 3 + 4 + 5 + 6 + 1000);
+      CHECK(r.b == (long) (0.5 * 4 + 0.25 * 2 + 7.5 - 1.5));
+      CHECK(r.c == 16);
+    }
+
+  ffi_closure_free(pcl1);
+  ffi_closure_free(pcl2);
+  ffi_closure_plan_free(plan);
+  exit(0);
+}
@@ -0,0 +1,87 @@
+/* Area:	ffi_closure_alloc, ffi_closure_free, ffi_closure_heap_trim
+   Purpose:	Check that closures stay callable, and can be freed, when
+		the closure heap is spread over many mappings, including
+		after trimming has unmapped some and new ones were mapped
+		in their place.
+   Limitations:	none.
+   PR:		none.
+   Originator:	closure allocation tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define N 256
+#define BIG 20000
+
+static void
+closure_test_fn (ffi_cif *cif __UNUSED__, void *resp, void **args,
+		 void *userdata)
+{
+  *(ffi_arg *)resp = *(int *)args[0] - (int)(intptr_t)userdata;
+}
+
+static void
+make (ffi_cif *cif, void **closure, void **code, size_t size, int tag)
+{
+  *closure = ffi_closure_alloc(size, code);
+  CHECK(*closure != NULL);
+  CHECK(ffi_prep_closure_loc(*closure, cif, closure_test_fn,
+			     (void *)(intptr_t)tag, *code) == FFI_OK);
+}
+
+static void
+check (ffi_cif *cif, void *code, int tag)
+{
+  int a = 1000;
+  void *values[1] = { &a };
+  ffi_arg r = 0;
+
+  ffi_call(cif, FFI_FN(code), &r, values);
+  CHECK((int) r == 1000 - tag);
+}
+
+int main (void)
+{
+  static void *big[N], *bigcode[N], *small[N], *smallcode[N];
+  ffi_cif cif;
+  ffi_type *args[1];
+  int i;
+
+  args[0] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  /* Large closures each need several pages, so the heap keeps
+     growing; small ones land in between.  */
+  for (i = 0; i < N; i++)
+    {
+      make(&cif, &big[i], &bigcode[i], BIG, i);
+      make(&cif, &small[i], &smallcode[i], sizeof(ffi_closure), -i);
+    }
+  for (i = 0; i < N; i++)
+    {
+      check(&cif, bigcode[i], i);
+      check(&cif, smallcode[i], -i);
+    }
+
+  /* Release the newer half of the large closures so the top of the
+     heap can be unmapped, then map new memory for them again.  */
+  for (i = N - 1; i >= N / 2; i--)
+    ffi_closure_free(big[i]);
+  ffi_closure_heap_trim(0);
+  for (i = N / 2; i < N; i++)
+    make(&cif, &big[i], &bigcode[i], BIG, i + N);
+
+  for (i = 0; i < N; i++)
+    {
+      check(&cif, bigcode[i], i < N / 2 ? i : i + N);
+      check(&cif, smallcode[i], -i);
+    }
+
+  for (i = 0; i < N; i++)
+    {
+      ffi_closure_free(big[i]);
+      ffi_closure_free(small[i]);
+    }
+  exit(0);
+}
@@ -0,0 +1,88 @@
+/* Area:	ffi_closure_alloc, ffi_closure_heap_trim
+   Purpose:	Check closures of every common size, and of an odd size,
+		allocated and freed in interleaved order: each must work,
+		small plain-data closures must not straddle a cache line,
+		and trimming after everything is freed must give memory
+		back.
+   Limitations:	The layout and trimming checks need static trampolines.
+   PR:		none.
+   Originator:	closure allocation tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define N 4000
+
+static void
+closure_test_fn (ffi_cif *cif __UNUSED__, void *resp, void **args,
+		 void *userdata)
+{
+  *(ffi_arg *)resp = *(int *)args[0] * 2 + (int)(intptr_t)userdata;
+}
+
+static const size_t sizes[] = {
+  sizeof(ffi_closure),
+  sizeof(ffi_raw_closure),
+  sizeof(ffi_closure) + 2 * sizeof(void *),
+  200
+};
+
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+int main (void)
+{
+  static void *closures[N], *code[N];
+  struct ffi_tramp_stats ts;
+  struct ffi_closure_heap_stats before, after;
+  ffi_cif cif;
+  ffi_type *args[1];
+  int i, tramps;
+
+  args[0] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+  tramps = ffi_tramp_stats(&ts);
+
+  for (i = 0; i < N; i++)
+    {
+      size_t size = sizes[i % NSIZES];
+      uintptr_t p;
+
+      closures[i] = ffi_closure_alloc(size, &code[i]);
+      CHECK(closures[i] != NULL);
+      p = (uintptr_t) closures[i];
+      CHECK(p % sizeof(void *) == 0);
+      if (tramps && size <= 64)
+	CHECK(p % 64 + size <= 64);
+      CHECK(ffi_prep_closure_loc(closures[i], &cif, closure_test_fn,
+				 (void *)(intptr_t)i, code[i]) == FFI_OK);
+    }
+
+  for (i = 0; i < N; i++)
+    {
+      int a = 5;
+      void *values[1] = { &a };
+      ffi_arg r = 0;
+
+      ffi_call(&cif, FFI_FN(code[i]), &r, values);
+      CHECK((int) r == 10 + i);
+    }
+
+  /* Free every other closure, then the rest backwards.  */
+  for (i = 0; i < N; i += 2)
+    ffi_closure_free(closures[i]);
+  for (i = N - 1; i > 0; i -= 2)
+    ffi_closure_free(closures[i]);
+
+  if (ffi_closure_heap_stats(&before))
+    {
+      CHECK(before.live_closures == 0);
+      ffi_closure_heap_trim(0);
+      CHECK(ffi_closure_heap_stats(&after));
+      CHECK(after.footprint <= before.footprint);
+      if (tramps)
+	CHECK(after.footprint < before.footprint);
+    }
+
+  exit(0);
+}
@@ -0,0 +1,111 @@
+/* Area:	closure_call, static trampolines
+   Purpose:	Check that a forked child can call the closures it inherited
+		and allocate new ones without setting up trampolines again:
+		with static trampolines, the child keeps the parent's
+		tables and maps no new one.
+   Limitations:	Only where fork () is available.
+   PR:		none.
+   Originator:	closure allocation tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#if defined (__unix__) || defined (__APPLE__)
+#include <unistd.h>
+#include <sys/wait.h>
+#define HAVE_FORK 1
+#endif
+
+#define MAX_HELD 100000
+
+static void
+closure_test_fn (ffi_cif *cif __UNUSED__, void *resp, void **args,
+		 void *userdata)
+{
+  *(ffi_arg *)resp = *(int *)args[0] + (int)(intptr_t)userdata;
+}
+
+typedef int (*closure_test_type)(int);
+
+static int
+make_and_call (ffi_cif *cif, int bias, int x)
+{
+  ffi_closure *closure;
+  void *code;
+  int r;
+
+  closure = ffi_closure_alloc(sizeof(ffi_closure), &code);
+  if (closure == NULL)
+    return -1;
+  if (ffi_prep_closure_loc(closure, cif, closure_test_fn,
+			   (void *)(intptr_t)bias, code) != FFI_OK)
+    return -1;
+  r = ((closure_test_type)code)(x);
+  ffi_closure_free(closure);
+  return r;
+}
+
+int main (void)
+{
+  ffi_cif cif;
+  ffi_type *args[1];
+  ffi_closure *closure;
+  void *code;
+  struct ffi_tramp_stats before, after;
+  static ffi_closure *held[MAX_HELD];
+  void *held_code;
+  int nheld = 0, i;
+
+  args[0] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  closure = ffi_closure_alloc(sizeof(ffi_closure), &code);
+  CHECK(closure != NULL);
+  CHECK(ffi_prep_closure_loc(closure, &cif, closure_test_fn,
+			     (void *)(intptr_t)100, code) == FFI_OK);
+  CHECK(((closure_test_type)code)(5) == 105);
+
+  /* Hold enough closures to need a second trampoline table, so that a
+     child which set trampolines up afresh would report fewer maps.  */
+  if (ffi_tramp_stats(&before))
+    while (before.maps < 2 && nheld < MAX_HELD)
+      {
+	held[nheld] = ffi_closure_alloc(sizeof(ffi_closure), &held_code);
+	CHECK(held[nheld] != NULL);
+	nheld++;
+	CHECK(ffi_tramp_stats(&before));
+      }
+
+#ifdef HAVE_FORK
+  {
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0)
+      {
+	/* The inherited closure, then fresh ones in the child.  */
+	if (((closure_test_type)code)(7) != 107)
+	  _exit(1);
+	for (i = 0; i < 100; i++)
+	  if (make_and_call(&cif, i, 1000) != 1000 + i)
+	    _exit(2);
+	if (ffi_tramp_stats(&after)
+	    && (after.maps != before.maps || after.tables != before.tables
+		|| after.tables == 0))
+	  _exit(3);
+	_exit(0);
+      }
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+#endif
+
+  CHECK(make_and_call(&cif, -3, 10) == 7);
+  for (i = 0; i < nheld; i++)
+    ffi_closure_free(held[i]);
+  ffi_closure_free(closure);
+  exit(0);
+}
@@ -0,0 +1,51 @@
+/* Area:	static trampolines
+   Purpose:	Check closures whose trampoline tables are carved out of a
+		region reserved up front (LIBFFI_TRAMP_RESERVE,
+		LIBFFI_TRAMP_POPULATE): more tables than the region holds,
+		released and then reused.
+   Limitations:	Targets without static trampolines ignore the settings.
+   PR:		none.
+   Originator:	closure allocation tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define N 3000
+
+typedef int (*closure_test_type)(int);
+
+static void
+closure_test_fn (ffi_cif *cif __UNUSED__, void *resp, void **args,
+		 void *userdata)
+{
+  *(ffi_arg *)resp = *(int *)args[0] - (int)(intptr_t)userdata;
+}
+
+int main (void)
+{
+  static void *closures[N], *code[N];
+  ffi_cif cif;
+  ffi_type *args[1];
+  int round, i;
+
+  /* Must be set before the first closure is allocated.  */
+  setenv("LIBFFI_TRAMP_RESERVE", "4", 1);
+  setenv("LIBFFI_TRAMP_POPULATE", "1", 1);
+
+  args[0] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  for (round = 0; round < 3; round++)
+    {
+      CHECK(ffi_closure_alloc_n(sizeof(ffi_closure), N, closures, code));
+      for (i = 0; i < N; i++)
+	CHECK(ffi_prep_closure_loc(closures[i], &cif, closure_test_fn,
+				   (void *)(intptr_t)i, code[i]) == FFI_OK);
+      for (i = 0; i < N; i++)
+	CHECK(((closure_test_type)code[i])(round) == round - i);
+      ffi_closure_free_n(closures, N);
+    }
+
+  exit(0);
+}
@@ -0,0 +1,74 @@
+/* Area:	ffi_tramp_stats, static trampolines
+   Purpose:	Check the static trampoline statistics as closures are
+		allocated and released, and that LIBFFI_TRAMP_KEEP keeps
+		that many completely free tables mapped.
+   Limitations:	Targets without static trampolines report nothing.
+   PR:		none.
+   Originator:	closure allocation tests  */
+
+/* { dg-do run } */
+#include "ffitest.h"
+
+#define N 2000
+
+static void
+closure_test_fn (ffi_cif *cif __UNUSED__, void *resp, void **args,
+		 void *userdata __UNUSED__)
+{
+  *(ffi_arg *)resp = *(int *)args[0];
+}
+
+int main (void)
+{
+  static void *closures[N], *code[N];
+  struct ffi_tramp_stats st;
+  ffi_cif cif;
+  ffi_type *args[1];
+  size_t tables;
+  int i;
+
+  /* Must be set before the first closure is allocated.  */
+  setenv("LIBFFI_TRAMP_KEEP", "2", 1);
+
+  args[0] = &ffi_type_sint;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  CHECK(ffi_closure_alloc_n(sizeof(ffi_closure), N, closures, code));
+  for (i = 0; i < N; i++)
+    CHECK(ffi_prep_closure_loc(closures[i], &cif, closure_test_fn, NULL,
+			       code[i]) == FFI_OK);
+
+  if (!ffi_tramp_stats(&st))
+    {
+      CHECK(st.tables == 0 && st.used_tramps == 0);
+      ffi_closure_free_n(closures, N);
+      exit(0);
+    }
+
+  CHECK(st.used_tramps >= N);
+  CHECK(st.tables > 0);
+  CHECK((st.used_tramps + st.free_tramps) % st.tables == 0);
+  CHECK(st.mapped_bytes > 0 && st.mapped_bytes % st.tables == 0);
+  CHECK(st.maps - st.unmaps == st.tables);
+  CHECK(st.keep_tables == 2);
+  tables = st.tables;
+
+  ffi_closure_free_n(closures, N);
+  CHECK(ffi_tramp_stats(&st));
+  CHECK(st.used_tramps == 0);
+  CHECK(st.empty_tables == st.tables);
+  CHECK(st.tables == (tables < 2 ? tables : 2));
+  CHECK(st.unmaps == tables - st.tables);
+  CHECK(st.maps - st.unmaps == st.tables);
+
+  /* The kept tables are used again before any new one is mapped.  */
+  CHECK(ffi_closure_alloc_n(sizeof(ffi_closure), 1, closures, code));
+  CHECK(ffi_tramp_stats(&st));
+  CHECK(st.used_tramps == 1);
+  CHECK(st.tables == (tables < 2 ? tables : 2));
+  CHECK(st.maps - st.unmaps == st.tables);
+  ffi_closure_free(closures[0]);
+
+  exit(0);
+}
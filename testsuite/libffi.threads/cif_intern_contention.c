@@ -0,0 +1,79 @@
+/* Area:	ffi_cif_intern, ffi_cif_intern_plan
+   Purpose:	Check that threads interning the same signatures at once all
+		get the same cif and plan for each, while the table grows
+		under them.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_cif_intern tests  */
+
+/* { dg-do run } */
+
+#include "ffitest.h"
+
+#include <pthread.h>
+
+#define NUM_THREADS 8
+#define NUM_SIGS 400
+
+static ffi_type types[NUM_SIGS];
+static ffi_type *elements[3] = { &ffi_type_sint, &ffi_type_double, NULL };
+static ffi_cif *seen[NUM_THREADS][NUM_SIGS];
+static ffi_call_plan *plans[NUM_THREADS][NUM_SIGS];
+
+static void *
+thread_func(void *arg)
+{
+  int id = (int)(intptr_t)arg;
+  ffi_type *args[2];
+  int i, j;
+
+  for (j = 0; j < NUM_SIGS; j++)
+    {
+      /* Each thread walks the signatures from a different start.  */
+      i = (j + id * (NUM_SIGS / NUM_THREADS)) % NUM_SIGS;
+      args[0] = &ffi_type_pointer;
+      args[1] = &types[i];
+      seen[id][i] = ffi_cif_intern(FFI_DEFAULT_ABI, 2, &ffi_type_sint, args,
+				   NULL);
+      CHECK(seen[id][i] != NULL);
+      plans[id][i] = ffi_cif_intern_plan(seen[id][i]);
+      CHECK(plans[id][i] != NULL);
+    }
+  return NULL;
+}
+
+int main (void)
+{
+  pthread_t threads[NUM_THREADS];
+  int i, t;
+
+  /* Lay the types out before the threads share them.  */
+  for (i = 0; i < NUM_SIGS; i++)
+    {
+      types[i].size = types[i].alignment = 0;
+      types[i].type = FFI_TYPE_STRUCT;
+      types[i].elements = elements;
+      CHECK(ffi_get_struct_offsets(FFI_DEFAULT_ABI, &types[i], NULL)
+	    == FFI_OK);
+    }
+
+  for (t = 0; t < NUM_THREADS; t++)
+    CHECK(pthread_create(&threads[t], NULL, thread_func,
+			 (void *)(intptr_t)t) == 0);
+  for (t = 0; t < NUM_THREADS; t++)
+    pthread_join(threads[t], NULL);
+
+  for (i = 0; i < NUM_SIGS; i++)
+    {
+      CHECK(seen[0][i]->arg_types[1] == &types[i]);
+      for (t = 1; t < NUM_THREADS; t++)
+	{
+	  CHECK(seen[t][i] == seen[0][i]);
+	  CHECK(plans[t][i] == plans[0][i]);
+	}
+      for (t = 0; t < i; t++)
+	CHECK(seen[0][t] != seen[0][i]);
+    }
+
+  exit(0);
+}
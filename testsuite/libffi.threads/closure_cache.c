@@ -0,0 +1,96 @@
+/* Area:	ffi_closure_alloc, ffi_closure_free
+   Purpose:	Check closures allocated and released from many threads at
+		once, enough per thread to refill and drain the per-thread
+		closure caches several times, including closures released
+		by a thread other than the one that allocated them and
+		threads that exit with closures still cached.
+   Limitations:	none.
+   PR:		none.
+   Originator:	closure cache tests  */
+
+/* { dg-do run } */
+
+#include "ffitest.h"
+
+#include <pthread.h>
+
+#define NUM_THREADS 8
+#define NUM_CLOSURES 200
+
+typedef int (*callback_fn)(int);
+
+static ffi_cif cif;
+static ffi_closure *handoff[NUM_THREADS][NUM_CLOSURES];
+static void *handoff_code[NUM_THREADS][NUM_CLOSURES];
+
+static void
+callback(ffi_cif *c __UNUSED__, void *ret, void **args, void *userdata)
+{
+  *(ffi_arg *)ret = *(int *)args[0] + (int)(intptr_t)userdata;
+}
+
+static void *
+thread_func(void *arg)
+{
+  int id = (int)(intptr_t)arg;
+  ffi_closure *own[NUM_CLOSURES];
+  void *code[NUM_CLOSURES];
+  int round, i;
+
+  for (round = 0; round < 4; round++)
+    {
+      for (i = 0; i < NUM_CLOSURES; i++)
+	{
+	  own[i] = ffi_closure_alloc(sizeof(ffi_closure), &code[i]);
+	  CHECK(own[i] != NULL);
+	  CHECK(ffi_prep_closure_loc(own[i], &cif, callback,
+				     (void *)(intptr_t)(id * 1000 + i),
+				     code[i]) == FFI_OK);
+	}
+      for (i = 0; i < NUM_CLOSURES; i++)
+	CHECK(((callback_fn)code[i])(round) == round + id * 1000 + i);
+
+      /* Release in a different order from the allocation.  */
+      for (i = 0; i < NUM_CLOSURES; i += 2)
+	ffi_closure_free(own[i]);
+      for (i = 1; i < NUM_CLOSURES; i += 2)
+	ffi_closure_free(own[i]);
+    }
+
+  /* Leave some closures for the main thread to release.  */
+  for (i = 0; i < NUM_CLOSURES; i++)
+    {
+      handoff[id][i] = ffi_closure_alloc(sizeof(ffi_closure),
+					 &handoff_code[id][i]);
+      CHECK(handoff[id][i] != NULL);
+      CHECK(ffi_prep_closure_loc(handoff[id][i], &cif, callback,
+				 (void *)(intptr_t)i, handoff_code[id][i])
+	    == FFI_OK);
+    }
+  return NULL;
+}
+
+int main (void)
+{
+  pthread_t threads[NUM_THREADS];
+  ffi_type *args[1] = { &ffi_type_sint };
+  int i, j;
+
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  for (i = 0; i < NUM_THREADS; i++)
+    CHECK(pthread_create(&threads[i], NULL, thread_func,
+			 (void *)(intptr_t)i) == 0);
+  for (i = 0; i < NUM_THREADS; i++)
+    CHECK(pthread_join(threads[i], NULL) == 0);
+
+  for (i = 0; i < NUM_THREADS; i++)
+    for (j = 0; j < NUM_CLOSURES; j++)
+      {
+	CHECK(((callback_fn)handoff_code[i][j])(5) == 5 + j);
+	ffi_closure_free(handoff[i][j]);
+      }
+
+  exit(0);
+}
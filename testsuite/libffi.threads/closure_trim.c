@@ -0,0 +1,139 @@
+/* Area:	ffi_closure_heap_trim
+   Purpose:	Check that trimming empties the closure caches of every
+		thread, not just the caller's, and that trimming while
+		other threads allocate and release closures leaves them
+		working.
+   Limitations:	Platforms without a closure heap report nothing.
+   PR:		none.
+   Originator:	closure cache tests  */
+
+/* { dg-do run } */
+
+#include "ffitest.h"
+
+#include <pthread.h>
+
+#define NUM_THREADS 4
+#define NUM_CLOSURES 40
+#define NUM_ROUNDS 200
+
+typedef int (*callback_fn)(int);
+
+static ffi_cif cif;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int ready, go, done;
+
+static void
+callback(ffi_cif *c __UNUSED__, void *ret, void **args, void *userdata)
+{
+  *(ffi_arg *)ret = *(int *)args[0] + (int)(intptr_t)userdata;
+}
+
+static void
+churn(int id, int round)
+{
+  ffi_closure *cl[NUM_CLOSURES];
+  void *code[NUM_CLOSURES];
+  int i;
+
+  for (i = 0; i < NUM_CLOSURES; i++)
+    {
+      cl[i] = ffi_closure_alloc(sizeof(ffi_closure), &code[i]);
+      CHECK(cl[i] != NULL);
+      CHECK(ffi_prep_closure_loc(cl[i], &cif, callback,
+				 (void *)(intptr_t)(id * 100 + i), code[i])
+	    == FFI_OK);
+    }
+  for (i = 0; i < NUM_CLOSURES; i++)
+    CHECK(((callback_fn)code[i])(round) == round + id * 100 + i);
+  for (i = 0; i < NUM_CLOSURES; i++)
+    ffi_closure_free(cl[i]);
+}
+
+/* Fill this thread's cache, then stay alive while the main thread
+   trims.  */
+static void *
+idle_thread(void *arg)
+{
+  int id = (int)(intptr_t)arg;
+
+  churn(id, 0);
+  pthread_mutex_lock(&lock);
+  ready++;
+  pthread_cond_broadcast(&cond);
+  while (!go)
+    pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+
+  churn(id, 1);
+  return NULL;
+}
+
+static void *
+busy_thread(void *arg)
+{
+  int id = (int)(intptr_t)arg, round;
+
+  for (round = 0; round < NUM_ROUNDS; round++)
+    churn(id, round);
+  pthread_mutex_lock(&lock);
+  done++;
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+int main (void)
+{
+  pthread_t threads[NUM_THREADS];
+  ffi_type *args[1] = { &ffi_type_sint };
+  struct ffi_closure_heap_stats st;
+  int i, finished;
+
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+  for (i = 0; i < NUM_THREADS; i++)
+    CHECK(pthread_create(&threads[i], NULL, idle_thread,
+			 (void *)(intptr_t)i) == 0);
+  pthread_mutex_lock(&lock);
+  while (ready < NUM_THREADS)
+    pthread_cond_wait(&cond, &lock);
+  pthread_mutex_unlock(&lock);
+
+  /* The other threads' caches hold closures until something trims.  */
+  ffi_closure_heap_trim(0);
+  if (ffi_closure_heap_stats(&st))
+    {
+      CHECK(st.cached_closures == 0);
+      CHECK(st.live_closures == 0);
+    }
+
+  pthread_mutex_lock(&lock);
+  go = 1;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&lock);
+  for (i = 0; i < NUM_THREADS; i++)
+    CHECK(pthread_join(threads[i], NULL) == 0);
+
+  /* Trim again and again while other threads churn.  */
+  for (i = 0; i < NUM_THREADS; i++)
+    CHECK(pthread_create(&threads[i], NULL, busy_thread,
+			 (void *)(intptr_t)i) == 0);
+  do
+    {
+      ffi_closure_heap_trim(0);
+      pthread_mutex_lock(&lock);
+      finished = done;
+      pthread_mutex_unlock(&lock);
+    }
+  while (finished < NUM_THREADS);
+  for (i = 0; i < NUM_THREADS; i++)
+    CHECK(pthread_join(threads[i], NULL) == 0);
+
+  ffi_closure_heap_trim(0);
+  if (ffi_closure_heap_stats(&st))
+    CHECK(st.cached_closures == 0 && st.live_closures == 0);
+
+  exit(0);
+}
@@ -0,0 +1,83 @@
+/* Area:	ffi_prep_cif
+   Purpose:	Check that threads preparing cifs at once over the same,
+		not yet laid out, nested struct types all see the complete
+		layout, and that the resulting cifs call correctly.
+   Limitations:	none.
+   PR:		none.
+   Originator:	ffi_prep_cif thread tests  */
+
+/* { dg-do run } */
+
+#include "ffitest.h"
+
+#include <pthread.h>
+
+#define NUM_THREADS 8
+#define NUM_ROUNDS 200
+
+struct inner { char c; double d; };
+struct outer { short s; struct inner in; int i; };
+
+static ffi_type inner_t, outer_t;
+static ffi_type *inner_e[3] = { &ffi_type_schar, &ffi_type_double, NULL };
+static ffi_type *outer_e[4] = { &ffi_type_sshort, &inner_t, &ffi_type_sint,
+				NULL };
+static pthread_barrier_t barrier;
+
+static double
+fold (struct outer o)
+{
+  return o.s + o.in.c * 2 + o.in.d * 3 + o.i * 4;
+}
+
+static void *
+thread_func(void *arg __UNUSED__)
+{
+  ffi_cif cif;
+  ffi_type *args[1];
+  struct outer o;
+  void *values[1];
+  double r;
+
+  pthread_barrier_wait(&barrier);
+  args[0] = &outer_t;
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_double, args)
+	== FFI_OK);
+  CHECK(outer_t.size == sizeof(struct outer));
+  CHECK(outer_t.alignment == __alignof__(struct outer));
+  CHECK(inner_t.size == sizeof(struct inner));
+
+  o.s = 3;
+  o.in.c = -5;
+  o.in.d = 0.5;
+  o.i = 1000;
+  values[0] = &o;
+  ffi_call(&cif, FFI_FN(fold), &r, values);
+  CHECK_DOUBLE_EQ(r, fold(o));
+  return NULL;
+}
+
+int main (void)
+{
+  pthread_t threads[NUM_THREADS];
+  int round, t;
+
+  pthread_barrier_init(&barrier, NULL, NUM_THREADS);
+  for (round = 0; round < NUM_ROUNDS; round++)
+    {
+      /* Fresh, unlaid-out types for every round.  */
+      inner_t.size = outer_t.size = 0;
+      inner_t.alignment = outer_t.alignment = 0;
+      inner_t.type = outer_t.type = FFI_TYPE_STRUCT;
+      inner_t.elements = inner_e;
+      outer_t.elements = outer_e;
+
+      for (t = 0; t < NUM_THREADS; t++)
+	CHECK(pthread_create(&threads[t], NULL, thread_func, NULL) == 0);
+      for (t = 0; t < NUM_THREADS; t++)
+	pthread_join(threads[t], NULL);
+    }
+  pthread_barrier_destroy(&barrier);
+
+  exit(0);
+}
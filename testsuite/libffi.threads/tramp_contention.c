@@ -0,0 +1,111 @@
+/* Area:	ffi_closure_alloc, ffi_closure_alloc_n, static trampolines
+   Purpose:	Contention benchmark for closure and trampoline allocation.
+		Every thread allocates, calls and frees closures as fast as
+		it can, both one at a time with a size the per-thread caches
+		do not serve and in small batches, so that the trampoline
+		allocator itself is hammered.  Reports the throughput and
+		checks every closure it calls.
+   Limitations:	none.
+   PR:		none.
+   Originator:	closure cache tests  */
+
+/* { dg-do run } */
+
+#include "ffitest.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define NUM_THREADS 8
+#define ITERATIONS 20000
+#define BATCH 8
+
+typedef int (*callback_fn)(int);
+
+/* Too big for the per-thread closure caches.  */
+struct big_closure
+{
+  ffi_closure closure;
+  char pad[256];
+};
+
+static ffi_cif cif;
+
+#if defined(_POSIX_BARRIERS) && _POSIX_BARRIERS > 0
+static pthread_barrier_t barrier;
+#endif
+
+static void
+callback(ffi_cif *c __UNUSED__, void *ret, void **args, void *userdata)
+{
+  *(ffi_arg *)ret = *(int *)args[0] + (int)(intptr_t)userdata;
+}
+
+static void *
+thread_func(void *arg)
+{
+  int id = (int)(intptr_t)arg;
+  void *closures[BATCH], *code[BATCH];
+  struct big_closure *big;
+  void *big_code;
+  int i, j;
+
+#if defined(_POSIX_BARRIERS) && _POSIX_BARRIERS > 0
+  pthread_barrier_wait(&barrier);
+#endif
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      big = ffi_closure_alloc(sizeof(*big), &big_code);
+      CHECK(big != NULL);
+      CHECK(ffi_prep_closure_loc(&big->closure, &cif, callback,
+				 (void *)(intptr_t)id, big_code) == FFI_OK);
+      CHECK(((callback_fn)big_code)(i) == i + id);
+      ffi_closure_free(big);
+
+      if (i % BATCH != 0)
+	continue;
+      CHECK(ffi_closure_alloc_n(sizeof(ffi_closure), BATCH, closures, code));
+      for (j = 0; j < BATCH; j++)
+	CHECK(ffi_prep_closure_loc(closures[j], &cif, callback,
+				   (void *)(intptr_t)j, code[j]) == FFI_OK);
+      CHECK(((callback_fn)code[i % BATCH])(id) == id + i % BATCH);
+      ffi_closure_free_n(closures, BATCH);
+    }
+  return NULL;
+}
+
+int main (void)
+{
+  pthread_t threads[NUM_THREADS];
+  ffi_type *args[1] = { &ffi_type_sint };
+  struct timespec t0, t1;
+  double secs;
+  int i;
+
+  CHECK(ffi_prep_cif(&cif, FFI_DEFAULT_ABI, 1, &ffi_type_sint, args)
+	== FFI_OK);
+
+#if defined(_POSIX_BARRIERS) && _POSIX_BARRIERS > 0
+  pthread_barrier_init(&barrier, NULL, NUM_THREADS);
+#endif
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < NUM_THREADS; i++)
+    CHECK(pthread_create(&threads[i], NULL, thread_func,
+			 (void *)(intptr_t)i) == 0);
+  for (i = 0; i < NUM_THREADS; i++)
+    CHECK(pthread_join(threads[i], NULL) == 0);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+#if defined(_POSIX_BARRIERS) && _POSIX_BARRIERS > 0
+  pthread_barrier_destroy(&barrier);
+#endif
+
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  printf("%d threads: %d closure alloc/free pairs in %.3f s (%.0f/s)\n",
+	 NUM_THREADS, NUM_THREADS * ITERATIONS * 2, secs,
+	 NUM_THREADS * ITERATIONS * 2 / secs);
+
+  exit(0);
+}